@@ -17,24 +17,28 @@
 #include "../libs/aabb.hpp"
 #include "../libs/bvh.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
-#include "../libs/stl_io.hpp"
+#include "../libs/mesh_io.hpp"
 
 int main(int argc, char *argv[]) {
   if (argc != 2) {
-    std::cerr << "Expected arguments: /path/to/input.stl" << std::endl;
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply}" << std::endl;
     return 1;
   }
 
   const char *input_path = argv[1];
 
   auto t0 = std::chrono::high_resolution_clock::now();
-  auto tris = read_stl(input_path);
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
   auto t1 = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
-  std::cout << "Read " << tris.size() << " triangles in " << duration.count()
-            << " ms" << std::endl;
+  std::cout << "Read " << mesh.tris.size() << " triangles in "
+            << duration.count() << " ms" << std::endl;
 
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
+  auto tris = mesh.to_tris();
   auto vertex_normals = mesh.calc_vertex_normals();
 
   std::vector<Triangle<float>> tris_float;
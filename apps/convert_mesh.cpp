@@ -0,0 +1,49 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "../libs/cli.hpp"
+#include "../libs/gpm_io.hpp"
+#include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+
+int main(int argc, char *argv[]) {
+  bool is_compressed = has_option(argc, argv, "compress");
+  if (count_positional_args(argc, argv) != 3 ||
+      (is_compressed && !is_gpm_path(argv[2]))) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply,off,gpm} "
+                 "/path/to/output.{stl,ply,gpm} [--compress], compress "
+                 "requires a .gpm output"
+              << std::endl;
+    return 1;
+  }
+  const char *input_path = argv[1];
+  const char *output_path = argv[2];
+
+  Indexed_Tri_Mesh<double> mesh;
+  auto t0 = std::chrono::high_resolution_clock::now();
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  double input_megabytes = std::filesystem::file_size(input_path) / 1e6;
+  std::cout << "Read " << mesh.vertices.size() << " vertices and "
+            << mesh.tris.size() << " triangles (" << input_megabytes
+            << " MB) in " << duration.count() << " ms, "
+            << input_megabytes / (duration.count() / 1000) << " MB/s"
+            << std::endl;
+
+  t0 = std::chrono::high_resolution_clock::now();
+  if (is_compressed) {
+    write_gpm(output_path, mesh, Gpm_Type::F64, {}, Gpm_Encoding::Packed);
+  } else {
+    write_indexed_mesh(output_path, mesh);
+  }
+  t1 = std::chrono::high_resolution_clock::now();
+  duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Wrote " << std::filesystem::file_size(output_path) / 1e6
+            << " MB in " << duration.count() << " ms" << std::endl;
+}
\ No newline at end of file
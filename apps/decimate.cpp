@@ -0,0 +1,37 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "../libs/cli.hpp"
+#include "../libs/decimation.hpp"
+#include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+
+int main(int argc, char *argv[]) {
+  size_t num_patches =
+      std::strtoull(get_option(argc, argv, "patches", "1"), nullptr, 10);
+  if (count_positional_args(argc, argv) != 4 || num_patches == 0) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} "
+                 "target_num_tris /path/to/output.{stl,ply} "
+                 "[--patches=num_patches]"
+              << std::endl;
+    return 1;
+  }
+  char *input_path = argv[1];
+  size_t target_num_tris = std::strtoull(argv[2], nullptr, 10);
+  char *output_path = argv[3];
+
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto decimated = decimate_mesh(mesh, target_num_tris, num_patches);
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Decimated " << mesh.tris.size() << " to "
+            << decimated.tris.size() << " triangles in " << duration.count()
+            << " ms" << std::endl;
+  write_indexed_mesh(output_path, decimated);
+}
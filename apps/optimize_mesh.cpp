@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "../libs/cli.hpp"
+#include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/mesh_reorder.hpp"
+
+static double time_vertex_normals(const Indexed_Tri_Mesh<double> &mesh) {
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto vertex_normals = mesh.calc_vertex_normals();
+  auto t1 = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main(int argc, char *argv[]) {
+  const char *vertex_order = get_option(argc, argv, "vertex-order", "hilbert");
+  const char *tri_order = get_option(argc, argv, "tri-order", "cache");
+  bool is_morton = std::strcmp(vertex_order, "morton") == 0;
+  bool is_hilbert = std::strcmp(vertex_order, "hilbert") == 0;
+  bool is_first_use = std::strcmp(vertex_order, "first-use") == 0;
+  bool is_cache = std::strcmp(tri_order, "cache") == 0;
+  if (count_positional_args(argc, argv) != 3 ||
+      (!is_morton && !is_hilbert && !is_first_use &&
+       std::strcmp(vertex_order, "none") != 0) ||
+      (!is_cache && std::strcmp(tri_order, "none") != 0)) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply,gpm} "
+                 "/path/to/output.{stl,ply,gpm} "
+                 "[--vertex-order=hilbert|morton|first-use|none] "
+                 "[--tri-order=cache|none]"
+              << std::endl;
+    return 1;
+  }
+  const char *input_path = argv[1];
+  const char *output_path = argv[2];
+
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
+  std::cout << "Before: ACMR " << calc_average_cache_miss_ratio(mesh)
+            << ", vertex normals in " << time_vertex_normals(mesh) << " ms"
+            << std::endl;
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  if (is_morton || is_hilbert) {
+    permute_vertices(mesh, calc_spatial_vertex_order(
+                               mesh, is_morton ? Vertex_Order::Morton
+                                               : Vertex_Order::Hilbert));
+  }
+  if (is_cache) {
+    permute_tris(mesh, calc_vertex_cache_tri_order(mesh));
+  }
+  // Follows the final triangle order, so it is applied last
+  if (is_first_use) {
+    permute_vertices(mesh, calc_first_use_vertex_order(mesh));
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Reordered mesh in " << duration.count() << " ms" << std::endl;
+
+  std::cout << "After: ACMR " << calc_average_cache_miss_ratio(mesh)
+            << ", vertex normals in " << time_vertex_normals(mesh) << " ms"
+            << std::endl;
+  write_indexed_mesh(output_path, mesh);
+}
\ No newline at end of file
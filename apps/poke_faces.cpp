@@ -1,37 +1,83 @@
-#include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
+#include "../libs/cli.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/parallel.hpp"
 #include "../libs/stl_io.hpp"
+#include "../libs/subdivision.hpp"
 #include "../libs/triangle.hpp"
 
+// Pokes a binary STL file batch by batch straight into the output STL file,
+// without building an indexed mesh.
+static bool poke_faces_streaming(const char *input_path,
+                                 const char *output_path) {
+  constexpr size_t tris_per_batch = 1 << 16;
+
+  Stl_Reader reader(input_path);
+  if (!reader.is_binary) {
+    std::cerr << "Streaming mode requires a binary STL file" << std::endl;
+    return false;
+  }
+  if (reader.num_tris > UINT32_MAX / 3) {
+    std::cerr << "Too many triangles for an STL file" << std::endl;
+    return false;
+  }
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  Stl_Writer writer(output_path, reader.num_tris * 3);
+  std::vector<Triangle<double>> batch;
+  batch.reserve(tris_per_batch);
+  Vec3<double> zero(0, 0, 0);
+  std::vector<Triangle<double>> poked(tris_per_batch * 3,
+                                      Triangle<double>{zero, zero, zero});
+  while (reader.read_tris(batch, tris_per_batch) > 0) {
+    parallel_for(batch.size(),
+                 [&](size_t i) { poke_triangle(batch[i], &poked[i * 3]); });
+    writer.write_tris(poked.data(), batch.size() * 3);
+    batch.clear();
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Poked " << reader.num_tris << " triangles in "
+            << duration.count() << " ms" << std::endl;
+  return true;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cerr << "Expected arguments: /path/to/input.stl /path/to/output.stl"
+  const char *mode = get_option(argc, argv, "mode", "indexed");
+  bool is_streaming = std::strcmp(mode, "streaming") == 0;
+  if (count_positional_args(argc, argv) != 3 ||
+      (!is_streaming && std::strcmp(mode, "indexed") != 0) ||
+      (is_streaming && is_indexed_mesh_path(argv[2]))) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} "
+                 "/path/to/output.{stl,ply} [--mode=indexed|streaming], "
+                 "streaming reads and writes STL files"
               << std::endl;
     return 1;
   }
   char *input_path = argv[1];
   char *output_path = argv[2];
 
-  auto tris = read_stl(input_path);
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-  Indexed_Tri_Mesh<double> subdivided_mesh;
-  subdivided_mesh.vertices = mesh.vertices;
-  for (const auto &t : mesh.tris) {
-    auto v1 = mesh.vertices[t[0]];
-    auto v2 = mesh.vertices[t[1]];
-    auto v3 = mesh.vertices[t[2]];
-    auto center = (v1 + v2 + v3) / 3.0;
-    auto center_index = (uint32_t)subdivided_mesh.vertices.size();
-    subdivided_mesh.vertices.push_back(center);
-    std::array<uint32_t, 3> t1{t[0], t[1], center_index};
-    std::array<uint32_t, 3> t2{t[1], t[2], center_index};
-    std::array<uint32_t, 3> t3{t[2], t[0], center_index};
-    subdivided_mesh.tris.insert(subdivided_mesh.tris.end(), {t1, t2, t3});
+  if (is_streaming) {
+    return poke_faces_streaming(input_path, output_path) ? 0 : 1;
+  }
+
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
   }
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto subdivided_mesh = poke_faces(mesh);
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Poked " << mesh.tris.size() << " triangles in "
+            << duration.count() << " ms" << std::endl;
 
-  write_stl_binary(output_path, subdivided_mesh.to_tris());
-}
\ No newline at end of file
+  write_indexed_mesh(output_path, subdivided_mesh);
+}
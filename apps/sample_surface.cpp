@@ -1,19 +1,191 @@
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <random>
+#include <string_view>
 #include <vector>
 
+#include "../libs/aabb.hpp"
+#include "../libs/alias_table.hpp"
+#include "../libs/cli.hpp"
 #include "../libs/ply_io.hpp"
+#include "../libs/point_cloud.hpp"
 #include "../libs/stl_io.hpp"
+#include "../libs/surface_sampling.hpp"
+
+// Parses a comma separated list of attribute names, returns false on unknown
+// names.
+static bool parse_attributes(std::string_view list, uint32_t &attributes) {
+  attributes = 0;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    auto name = list.substr(0, comma);
+    list = comma == list.npos ? std::string_view() : list.substr(comma + 1);
+    if (name == "normal") {
+      attributes |= Point_Normal;
+    } else if (name == "tri_index") {
+      attributes |= Point_Tri_Index;
+    } else if (name == "barycentric") {
+      attributes |= Point_Barycentric;
+    } else if (name == "color") {
+      attributes |= Point_Color;
+    } else if (!name.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::vector<std::array<uint8_t, 3>>
+stl_attributes_to_colors(const std::vector<uint16_t> &stl_attributes) {
+  std::vector<std::array<uint8_t, 3>> colors;
+  colors.reserve(stl_attributes.size());
+  for (auto a : stl_attributes) {
+    colors.push_back(stl_attribute_to_color(a));
+  }
+  return colors;
+}
+
+// Uniform sampling in two passes over a binary STL file. The first pass sums
+// the area of every chunk of triangles and distributes the samples over the
+// chunks, the second pass re-reads every chunk and writes its samples straight
+// to the output, so memory use only depends on the chunk size.
+static bool sample_surface_streaming(const char *input_path,
+                                     size_t num_samples, uint64_t seed,
+                                     const char *output_path,
+                                     Ply_Points_Format output_format) {
+  constexpr size_t tris_per_chunk = 1 << 16;
+  constexpr size_t samples_per_batch = 1 << 20;
+
+  Stl_Reader reader(input_path);
+  if (!reader.is_binary) {
+    std::cerr << "Streaming mode requires a binary STL file" << std::endl;
+    return false;
+  }
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  std::vector<Triangle<double>> chunk_tris;
+  chunk_tris.reserve(tris_per_chunk);
+  std::vector<double> chunk_areas;
+  double total_area = 0.0;
+  AABB<double> bounds;
+  while (reader.read_tris(chunk_tris, tris_per_chunk) > 0) {
+    if (chunk_areas.empty()) {
+      bounds = chunk_tris[0].calc_aabb();
+    }
+    for (const auto &t : chunk_tris) {
+      bounds = bounds.join(t.calc_aabb());
+    }
+    double chunk_area = 0.0;
+    for (double area : calc_triangle_areas(chunk_tris)) {
+      chunk_area += area;
+    }
+    chunk_areas.push_back(chunk_area);
+    total_area += chunk_area;
+    chunk_tris.clear();
+  }
+  if (chunk_areas.empty()) {
+    std::cerr << "No triangles to sample in " << input_path << std::endl;
+    return false;
+  }
+
+  // Multinomial split of the samples over chunks. The last chunk with area
+  // takes all remaining samples, so rounding in remaining_area cannot leave
+  // any of them out.
+  size_t last_chunk = 0;
+  for (size_t i = 0; i < chunk_areas.size(); i++) {
+    if (chunk_areas[i] > 0) {
+      last_chunk = i;
+    }
+  }
+  std::mt19937_64 rng(seed);
+  std::vector<size_t> chunk_num_samples(chunk_areas.size(), 0);
+  size_t remaining_samples = num_samples;
+  double remaining_area = total_area;
+  for (size_t i = 0; i < chunk_areas.size() && remaining_samples > 0; i++) {
+    double p = i != last_chunk && remaining_area > 0
+                   ? chunk_areas[i] / remaining_area
+                   : 1.0;
+    std::binomial_distribution<size_t> dist(remaining_samples,
+                                            std::min(1.0, p));
+    chunk_num_samples[i] = dist(rng);
+    remaining_samples -= chunk_num_samples[i];
+    remaining_area -= chunk_areas[i];
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Read " << reader.num_tris << " triangles in "
+            << chunk_areas.size() << " chunks in " << duration.count()
+            << " ms" << std::endl;
+
+  t0 = std::chrono::high_resolution_clock::now();
+  const uint32_t attributes = output_format.attributes;
+  const bool needs_colors = attributes & Point_Color;
+  output_format.bounds = bounds;
+  Ply_Points_Writer writer(output_path, num_samples, output_format);
+  std::vector<uint16_t> chunk_stl_attributes;
+  reader.rewind();
+  for (size_t chunk = 0; chunk < chunk_areas.size(); chunk++) {
+    reader.read_tris(chunk_tris, tris_per_chunk,
+                     needs_colors ? &chunk_stl_attributes : nullptr);
+    if (chunk_num_samples[chunk] > 0) {
+      auto triangle_table = Alias_Table::build(calc_triangle_areas(chunk_tris));
+      auto chunk_colors = stl_attributes_to_colors(chunk_stl_attributes);
+      auto chunk_seed = make_block_rng(seed, chunk)();
+      for (size_t batch = 0, offset = 0; offset < chunk_num_samples[chunk];
+           batch++, offset += samples_per_batch) {
+        size_t batch_num_samples =
+            std::min(samples_per_batch, chunk_num_samples[chunk] - offset);
+        auto samples = sample_surface_uniform(
+            chunk_tris, triangle_table, batch_num_samples,
+            make_block_rng(chunk_seed, batch)(), attributes != 0);
+        fill_point_attributes(samples, chunk_tris, attributes, &chunk_colors,
+                              uint32_t(chunk * tris_per_chunk));
+        writer.write(samples);
+      }
+    }
+    chunk_tris.clear();
+    chunk_stl_attributes.clear();
+  }
+  t1 = std::chrono::high_resolution_clock::now();
+  duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Sampled " << num_samples << " points in "
+            << duration.count() << " ms" << std::endl;
+  return true;
+}
 
 int main(int argc, char *argv[]) {
-  if (argc != 5) {
+  const char *mode = get_option(argc, argv, "mode", "uniform");
+  bool is_poisson_disk = std::strcmp(mode, "poisson") == 0;
+  bool is_streaming = std::strcmp(mode, "streaming") == 0;
+  const char *layout = get_option(argc, argv, "layout", "interleaved");
+  bool is_separate = std::strcmp(layout, "separate") == 0;
+  const char *precision = get_option(argc, argv, "precision", "double");
+  bool is_float = std::strcmp(precision, "float") == 0;
+  bool is_uint16 = std::strcmp(precision, "uint16") == 0;
+  Ply_Points_Format output_format;
+  output_format.layout =
+      is_separate ? Ply_Layout::Separate_Elements : Ply_Layout::Interleaved;
+  output_format.precision = is_float    ? Ply_Precision::Float32
+                            : is_uint16 ? Ply_Precision::Quantized16
+                                        : Ply_Precision::Float64;
+  if (count_positional_args(argc, argv) != 5 ||
+      (!is_poisson_disk && !is_streaming &&
+       std::strcmp(mode, "uniform") != 0) ||
+      (!is_separate && std::strcmp(layout, "interleaved") != 0) ||
+      (!is_float && !is_uint16 && std::strcmp(precision, "double") != 0) ||
+      !parse_attributes(get_option(argc, argv, "attributes", ""),
+                        output_format.attributes)) {
     std::cerr << "Expected arguments: /path/to/input.stl num_samples seed "
-                 "/path/to/output.ply"
+                 "/path/to/output.ply [--mode=uniform|poisson|streaming] "
+                 "[--attributes=normal,tri_index,barycentric,color] "
+                 "[--layout=interleaved|separate] "
+                 "[--precision=double|float|uint16]"
               << std::endl;
     return 1;
   }
@@ -22,49 +194,50 @@ int main(int argc, char *argv[]) {
   size_t num_samples = std::strtoull(argv[2], nullptr, 10);
   size_t seed = std::strtoull(argv[3], nullptr, 10);
   const char *output_path = argv[4];
+  const uint32_t attributes = output_format.attributes;
+
+  if (is_streaming) {
+    return sample_surface_streaming(input_path, num_samples, seed,
+                                    output_path, output_format)
+               ? 0
+               : 1;
+  }
 
   auto t0 = std::chrono::high_resolution_clock::now();
-  auto tris = read_stl(input_path);
+  std::vector<uint16_t> stl_attributes;
+  auto tris = read_stl(input_path,
+                       attributes & Point_Color ? &stl_attributes : nullptr);
   auto t1 = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
   std::cout << "Read " << tris.size() << " triangles in " << duration.count()
             << " ms" << std::endl;
 
-  std::vector<double> areas;
-  areas.reserve(tris.size());
-  for (const auto &t : tris) {
-    areas.push_back(t.calc_area());
-  }
-
-  std::mt19937_64 rng(seed);
-  std::discrete_distribution<size_t> triangle_area_dist(areas.begin(),
-                                                        areas.end());
-  std::uniform_real_distribution<double> real_dist(0.0, 1.0);
-
-  std::vector<Vec3<double>> samples;
-  samples.reserve(num_samples);
   t0 = std::chrono::high_resolution_clock::now();
-  for (size_t i = 0; i < num_samples; i++) {
-    size_t triangle_index = triangle_area_dist(rng);
-    const Triangle<double> &t = tris[triangle_index];
-
-    // Sample the triangle uniformly:
-    // https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations#SamplingaTriangle
-    double r1 = real_dist(rng);
-    double r2 = real_dist(rng);
-    double sqrt_r1 = std::sqrt(r1);
-    double u = 1 - sqrt_r1;
-    double v = r2 * sqrt_r1;
-
-    auto ab = t.b - t.a;
-    auto ac = t.c - t.a;
+  auto areas = calc_triangle_areas(tris);
+  auto triangle_table = Alias_Table::build(areas);
+  t1 = std::chrono::high_resolution_clock::now();
+  duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Built alias table in " << duration.count() << " ms"
+            << std::endl;
 
-    Vec3<double> sample_point = u * ab + v * ac + t.a;
-    samples.push_back(sample_point);
-  }
+  t0 = std::chrono::high_resolution_clock::now();
+  auto samples = is_poisson_disk
+                     ? sample_surface_poisson_disk(tris, triangle_table,
+                                                   num_samples, seed,
+                                                   attributes != 0)
+                     : sample_surface_uniform(tris, triangle_table,
+                                              num_samples, seed,
+                                              attributes != 0);
+  auto tri_colors = stl_attributes_to_colors(stl_attributes);
+  fill_point_attributes(samples, tris, attributes, &tri_colors);
+  t1 = std::chrono::high_resolution_clock::now();
+  duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Sampled " << samples.size() << " points in "
+            << duration.count() << " ms" << std::endl;
+  t0 = std::chrono::high_resolution_clock::now();
+  write_points_to_ply(output_path, samples, output_format);
   t1 = std::chrono::high_resolution_clock::now();
   duration = std::chrono::duration<double, std::milli>(t1 - t0);
-  std::cout << "Sampled " << num_samples << " points in " << duration.count()
+  std::cout << "Wrote " << samples.size() << " points in " << duration.count()
             << " ms" << std::endl;
-  write_points_to_ply(output_path, samples);
 }
\ No newline at end of file
@@ -1,62 +1,65 @@
+#include <chrono>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
-#include <stack>
 #include <string>
 #include <vector>
 
+#include "../libs/cli.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/mesh_islands.hpp"
+#include "../libs/parallel.hpp"
 #include "../libs/stl_io.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Expected arguments: /path/to/input.stl" << std::endl;
+  if (count_positional_args(argc, argv) != 2) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} "
+                 "[--labels=/path/to/labels.bin]"
+              << std::endl;
     return 1;
   }
-  auto tris = read_stl(argv[1]);
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-  std::vector<bool> tris_visited(mesh.tris.size(), false);
-  std::vector<bool> vertices_visited(mesh.vertices.size(), false);
-  std::vector<std::vector<uint32_t>> per_vertex_neighbour_tris;
-  per_vertex_neighbour_tris.resize(mesh.vertices.size());
-  for (size_t i = 0; i < mesh.tris.size(); i++) {
-    const auto &t = mesh.tris[i];
-    for (int j = 0; j < 3; j++) {
-      per_vertex_neighbour_tris[t[j]].push_back(i);
-    }
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(argv[1], mesh)) {
+    std::cerr << "Failed to read mesh: " << argv[1] << std::endl;
+    return 1;
   }
-  std::vector<Indexed_Tri_Mesh<double>> islands;
-  for (size_t i = 0; i < mesh.vertices.size(); i++) {
-    if (vertices_visited[i]) {
-      continue;
-    }
-    Indexed_Tri_Mesh<double> island;
-    island.vertices = mesh.vertices;
-    std::stack<size_t> stack;
-    stack.push(i);
-    while (!stack.empty()) {
-      auto vi = stack.top();
-      stack.pop();
-      if (vertices_visited[vi]) {
-        continue;
-      }
-      vertices_visited[vi] = true;
-      for (const auto &ti : per_vertex_neighbour_tris[vi]) {
-        if (tris_visited[ti]) {
-          continue;
-        }
-        const auto &t = mesh.tris[ti];
-        island.tris.push_back(t);
-        tris_visited[ti] = true;
-        stack.push(t[0]);
-        stack.push(t[1]);
-        stack.push(t[2]);
-      }
+
+  // Only writes the island of every triangle as little endian uint32
+  if (has_option(argc, argv, "labels")) {
+    const char *labels_path = get_option(argc, argv, "labels", "");
+    auto t0 = std::chrono::high_resolution_clock::now();
+    size_t num_islands = 0;
+    auto labels =
+        find_tri_islands(mesh.tris, mesh.vertices.size(), num_islands);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+    std::cout << "Found " << num_islands << " islands in " << duration.count()
+              << " ms" << std::endl;
+    std::ofstream ofs(labels_path, std::ios::binary);
+    ofs.write(reinterpret_cast<const char *>(labels.data()),
+              labels.size() * sizeof(uint32_t));
+    if (!ofs) {
+      std::cerr << "Failed to write labels: " << labels_path << std::endl;
+      return 1;
     }
-    islands.push_back(island);
+    return 0;
   }
 
-  for (size_t i = 0; i < islands.size(); i++) {
-    std::string filename = "island_" + std::to_string(i) + ".stl";
-    write_stl_binary(filename.c_str(), islands[i].to_tris());
-  }
-}
\ No newline at end of file
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto islands = find_mesh_islands(mesh.tris, mesh.vertices.size());
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Found " << islands.size() << " islands in " << duration.count()
+            << " ms" << std::endl;
+
+  // Every thread extracts and writes one island at a time
+  parallel_for(
+      islands.size(),
+      [&](size_t i) {
+        std::string filename = "island_" + std::to_string(i) + ".stl";
+        write_stl_binary(filename.c_str(),
+                         extract_island(mesh, islands, i).to_tris());
+      },
+      1);
+}
@@ -1,13 +1,33 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
+#include "../libs/cli.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
-#include "../libs/stl_io.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/mesh_offset.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    std::cerr << "Expected arguments: /path/to/input.stl fatten_factor "
-                 "/path/to/output.stl"
+  const char *weighting_name =
+      get_option(argc, argv, "normal-weighting", "uniform");
+  Normal_Weighting weighting = Normal_Weighting::Uniform;
+  if (std::strcmp(weighting_name, "area") == 0) {
+    weighting = Normal_Weighting::Area;
+  } else if (std::strcmp(weighting_name, "angle") == 0) {
+    weighting = Normal_Weighting::Angle;
+  } else if (std::strcmp(weighting_name, "uniform") != 0) {
+    weighting_name = nullptr;
+  }
+  const char *method = get_option(argc, argv, "method", "normals");
+  bool is_sdf = std::strcmp(method, "sdf") == 0;
+  if (count_positional_args(argc, argv) != 4 || !weighting_name ||
+      (!is_sdf && std::strcmp(method, "normals") != 0)) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} fatten_factor "
+                 "/path/to/output.{stl,ply} "
+                 "[--normal-weighting=uniform|area|angle] "
+                 "[--method=normals|sdf] [--voxel-size=size]"
               << std::endl;
     return 1;
   }
@@ -15,12 +35,38 @@ int main(int argc, char *argv[]) {
   double fatten_factor = std::strtod(argv[2], nullptr);
   char *output_path = argv[3];
 
-  auto tris = read_stl(input_path);
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-  auto vertex_normals = mesh.calc_vertex_normals();
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
+  if (is_sdf) {
+    // Offsets a closed mesh through its distance field, which keeps large
+    // offsets free of self-intersections
+    double voxel_size =
+        std::strtod(get_option(argc, argv, "voxel-size", "0"), nullptr);
+    if (voxel_size <= 0 && !mesh.vertices.empty()) {
+      Vec3<double> lo = mesh.vertices[0], hi = mesh.vertices[0];
+      for (const auto &v : mesh.vertices) {
+        lo = lo.min(v);
+        hi = hi.max(v);
+      }
+      auto extent = hi - lo;
+      voxel_size = std::max({extent.x, extent.y, extent.z}) / 128;
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    auto offset = offset_mesh(mesh, fatten_factor, voxel_size);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+    std::cout << "Offset to " << offset.tris.size() << " triangles in "
+              << duration.count() << " ms" << std::endl;
+    write_indexed_mesh(output_path, offset);
+    return 0;
+  }
+  auto vertex_normals = mesh.calc_vertex_normals(weighting);
   for (size_t i = 0; i < mesh.vertices.size(); i++) {
     auto n = vertex_normals[i];
     mesh.vertices[i] += n * fatten_factor;
   }
-  write_stl_binary(output_path, mesh.to_tris());
+  write_indexed_mesh(output_path, mesh);
 }
\ No newline at end of file
@@ -1,49 +1,66 @@
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <unordered_set>
-#include <vector>
 
+#include "../libs/cli.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
-#include "../libs/stl_io.hpp"
+#include "../libs/mesh_adjacency.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/smoothing.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    std::cerr << "Expected arguments: /path/to/input.stl num_iters "
-                 "/path/to/output.stl"
+  const char *scheme = get_option(argc, argv, "scheme", "uniform");
+  Smoothing_Params params;
+  bool is_valid_scheme = true;
+  if (std::strcmp(scheme, "taubin") == 0) {
+    params.scheme = Smoothing_Scheme::Taubin;
+    params.lambda = 0.5;
+  } else if (std::strcmp(scheme, "cotangent") == 0) {
+    params.scheme = Smoothing_Scheme::Cotangent;
+  } else {
+    is_valid_scheme = std::strcmp(scheme, "uniform") == 0;
+  }
+  if (count_positional_args(argc, argv) != 4 || !is_valid_scheme) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} num_iters "
+                 "/path/to/output.{stl,ply} "
+                 "[--scheme=uniform|taubin|cotangent] [--lambda=factor] "
+                 "[--mu=factor]"
               << std::endl;
     return 1;
   }
   char *input_path = argv[1];
-  size_t num_iters = std::strtoull(argv[2], nullptr, 10);
+  params.num_iters = std::strtoull(argv[2], nullptr, 10);
   char *output_path = argv[3];
-
-  auto tris = read_stl(input_path);
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-  std::vector<std::unordered_set<uint32_t>> vertex_graph;
-  vertex_graph.resize(mesh.vertices.size());
-  for (const auto &t : mesh.tris) {
-    vertex_graph[t[0]].insert({t[1], t[2]});
-    vertex_graph[t[1]].insert({t[0], t[2]});
-    vertex_graph[t[2]].insert({t[0], t[1]});
+  if (has_option(argc, argv, "lambda")) {
+    params.lambda = std::strtod(get_option(argc, argv, "lambda", ""), nullptr);
+  }
+  if (has_option(argc, argv, "mu")) {
+    params.mu = std::strtod(get_option(argc, argv, "mu", ""), nullptr);
   }
-  std::vector<Vec3<double>> smoothed_vertices;
-  smoothed_vertices.resize(mesh.vertices.size(), Vec3<double>(0, 0, 0));
-  auto smooth = [&]() {
-    for (size_t i = 0; i < mesh.vertices.size(); i++) {
-      auto neighbors = vertex_graph[i];
-      Vec3<double> mean(0, 0, 0);
-      for (const auto &ni : neighbors) {
-        auto nv = mesh.vertices[ni];
-        mean += nv;
-      }
-      mean /= neighbors.size();
-      smoothed_vertices[i] = mean;
-    }
-    mesh.vertices = smoothed_vertices;
-  };
 
-  for (int i = 0; i < num_iters; i++) {
-    smooth();
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
   }
-  write_stl_binary(output_path, mesh.to_tris());
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto neighbours =
+      build_vertex_vertex_adjacency(mesh.tris, mesh.vertices.size());
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Built adjacency in " << duration.count() << " ms"
+            << std::endl;
+
+  t0 = std::chrono::high_resolution_clock::now();
+  smooth_mesh(mesh, params, neighbours);
+  t1 = std::chrono::high_resolution_clock::now();
+  duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  size_t num_steps = params.num_iters *
+                     (params.scheme == Smoothing_Scheme::Taubin ? 2 : 1);
+  std::cout << "Smoothed " << mesh.vertices.size() << " vertices in "
+            << duration.count() << " ms, "
+            << mesh.vertices.size() * num_steps / (duration.count() * 1e3)
+            << " M vertex updates/s" << std::endl;
+  write_indexed_mesh(output_path, mesh);
 }
\ No newline at end of file
@@ -1,51 +1,129 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <optional>
-#include <unordered_map>
 #include <vector>
 
-#include "../libs/indexed_tri_edges_mesh.hpp"
+#include "../libs/cli.hpp"
+#include "../libs/half_edge_mesh.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mesh_io.hpp"
+#include "../libs/parallel.hpp"
 #include "../libs/stl_io.hpp"
+#include "../libs/subdivision.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cerr << "Expected arguments: /path/to/input.stl /path/to/output.stl"
+  const char *scheme_name = get_option(argc, argv, "scheme", "midpoint");
+  Subdivision_Scheme scheme = Subdivision_Scheme::Midpoint;
+  if (std::strcmp(scheme_name, "loop") == 0) {
+    scheme = Subdivision_Scheme::Loop;
+  } else if (std::strcmp(scheme_name, "butterfly") == 0) {
+    scheme = Subdivision_Scheme::Butterfly;
+  } else if (std::strcmp(scheme_name, "midpoint") != 0) {
+    scheme_name = nullptr;
+  }
+  size_t num_levels =
+      std::strtoull(get_option(argc, argv, "levels", "1"), nullptr, 10);
+  // Angles are given in degrees
+  Adaptive_Subdivision_Params adaptive_params;
+  adaptive_params.max_edge_length =
+      std::atof(get_option(argc, argv, "max-edge-length", "0"));
+  adaptive_params.max_normal_angle =
+      std::atof(get_option(argc, argv, "max-angle", "0")) *
+      (3.14159265358979323846 / 180);
+  bool is_adaptive = adaptive_params.max_edge_length > 0 ||
+                     adaptive_params.max_normal_angle > 0;
+  if (count_positional_args(argc, argv) != 3 || !scheme_name ||
+      num_levels == 0 || (is_adaptive && scheme == Subdivision_Scheme::Loop)) {
+    std::cerr << "Expected arguments: /path/to/input.{stl,ply} "
+                 "/path/to/output.{stl,ply} [--levels=num_levels] "
+                 "[--scheme=midpoint|loop|butterfly] "
+                 "[--max-edge-length=length] [--max-angle=degrees], loop "
+                 "does not support adaptive subdivision"
               << std::endl;
     return 1;
   }
   char *input_path = argv[1];
   char *output_path = argv[2];
 
-  auto tris = read_stl(input_path);
-  auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-  auto edges_mesh = Indexed_Tri_Edges_Mesh<double>::from_indexed_mesh(mesh);
-
-  std::vector<uint32_t> edge_centers;
-  edge_centers.reserve(edges_mesh.edges.size());
-  for (const auto &e : edges_mesh.edges) {
-    auto v1 = mesh.vertices[e.a];
-    auto v2 = mesh.vertices[e.b];
-    auto v = (v1 + v2) / 2.0;
-    mesh.vertices.push_back(v);
-    edge_centers.push_back(mesh.vertices.size() - 1);
+  Indexed_Tri_Mesh<double> mesh;
+  if (!read_indexed_mesh(input_path, mesh)) {
+    std::cerr << "Failed to read mesh: " << input_path << std::endl;
+    return 1;
+  }
+  auto t0 = std::chrono::high_resolution_clock::now();
+  if (is_adaptive) {
+    std::vector<std::array<uint32_t, 2>> green_pairs;
+    for (size_t level = 0; level < num_levels; level++) {
+      if (subdivide_adaptive(mesh, green_pairs, scheme, adaptive_params) ==
+          0) {
+        break;
+      }
+    }
+    write_indexed_mesh(output_path, mesh);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+    std::cout << "Subdivided to " << mesh.tris.size() << " triangles in "
+              << duration.count() << " ms" << std::endl;
+    return 0;
+  }
+  auto half_edge_mesh = Half_Edge_Mesh<double>::from_indexed_mesh(mesh);
+  mesh = {};
+  // Only num_levels - 1 levels are built, the last one is streamed from them
+  // and only needs its vertex indices, and the triangle count of STL files, to
+  // fit in 32 bits
+  bool is_indexed_output = is_indexed_mesh_path(output_path);
+  bool fits = can_subdivide_half_edge_mesh(half_edge_mesh, num_levels - 1);
+  if (fits) {
+    auto counts = get_subdivided_counts(half_edge_mesh, num_levels);
+    fits = counts.num_vertices <= UINT32_MAX &&
+           (is_indexed_output || counts.num_faces <= UINT32_MAX);
+  }
+  if (!fits) {
+    std::cerr << "Too many levels, the subdivided mesh would exceed 32 bit "
+                 "indices"
+              << std::endl;
+    return 1;
   }
-  std::vector<std::array<uint32_t, 3>> output_tris;
-  output_tris.reserve(tris.size() * 4);
+  subdivide_half_edge_mesh(half_edge_mesh, num_levels - 1, scheme);
 
-  for (size_t i = 0; i < tris.size(); i++) {
-    const auto &te = edges_mesh.tris[i];
-    auto ec1 = edge_centers[te[0]];
-    auto ec2 = edge_centers[te[1]];
-    auto ec3 = edge_centers[te[2]];
-    const auto &t = mesh.tris[i];
-    output_tris.push_back({ec1, ec2, ec3});
-    output_tris.push_back({t[0], ec1, ec3});
-    output_tris.push_back({t[1], ec2, ec1});
-    output_tris.push_back({t[2], ec3, ec2});
+  // The last level is only computed as far as the output needs it
+  const auto &last = half_edge_mesh;
+  const size_t num_tris = last.num_faces() * 4;
+  std::vector<Vec3<double>> vertices(last.vertices.size() + last.num_edges(),
+                                     Vec3<double>(0, 0, 0));
+  calc_subdivided_vertices(last, scheme, vertices.data());
+  if (!is_indexed_output) {
+    Stl_Writer writer(output_path, uint32_t(num_tris));
+    constexpr size_t max_batch_tris = 1 << 16;
+    Vec3<double> zero(0, 0, 0);
+    std::vector<Triangle<double>> batch(max_batch_tris,
+                                        Triangle<double>{zero, zero, zero});
+    for (size_t first = 0; first < num_tris; first += max_batch_tris) {
+      size_t batch_size = std::min(max_batch_tris, num_tris - first);
+      parallel_for(batch_size, [&](size_t i) {
+        size_t ti = first + i;
+        for (int k = 0; k < 3; k++) {
+          batch[i][k] = vertices[get_child_tri_vertex(
+              last, uint32_t(ti / 4), int(ti % 4), k)];
+        }
+      });
+      writer.write_tris(batch.data(), batch_size);
+    }
+  } else {
+    Indexed_Tri_Mesh<double> out;
+    out.vertices = std::move(vertices);
+    out.tris.resize(num_tris);
+    parallel_for(num_tris, [&](size_t i) {
+      out.tris[i] = get_child_tri(last, uint32_t(i / 4), int(i % 4));
+    });
+    write_indexed_mesh(output_path, out);
   }
-  mesh.tris = output_tris;
-  write_stl_binary(output_path, mesh.to_tris());
-}
\ No newline at end of file
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration<double, std::milli>(t1 - t0);
+  std::cout << "Subdivided to " << num_tris << " triangles in "
+            << duration.count() << " ms" << std::endl;
+}
@@ -1,55 +1,121 @@
+#include <algorithm>
 #include <array>
 #include <bitset>
-#include <cassert>
+#include <condition_variable>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "../libs/cli.hpp"
 #include "../libs/fast_float.hpp"
+#include "../libs/gpm_io.hpp"
 #include "../libs/indexed_tri_mesh.hpp"
+#include "../libs/mapped_file.hpp"
+#include "../libs/parallel.hpp"
 #include "../libs/ply_io.hpp"
 #include "../libs/stl_io.hpp"
 #include "../libs/vec3.hpp"
+#include "../libs/voxel_meshing.hpp"
 
-using DICT = std::unordered_map<std::string, std::string>;
+// Little endian reads from a memory mapped VOX file, which fail instead of
+// running past the end of the data
+struct Vox_Reader {
+  std::string_view data;
+  size_t offset = 0;
 
-static std::string read_string(std::ifstream &ifs) {
-  uint32_t buffer_size;
-  ifs.read(reinterpret_cast<char *>(&buffer_size), sizeof(uint32_t));
-  assert(buffer_size >= 0);
-  if (buffer_size == 0) {
-    return std::string();
+  template <typename T> bool read(T &out) {
+    if (data.size() - offset < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&out, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
   }
-  std::string result(buffer_size, 0);
-  ifs.read(result.data(), buffer_size);
-  return result;
+
+  bool read_bytes(size_t size, std::string_view &out) {
+    if (data.size() - offset < size) {
+      return false;
+    }
+    out = data.substr(offset, size);
+    offset += size;
+    return true;
+  }
+
+  bool read_string(std::string_view &out) {
+    uint32_t size;
+    return read(size) && read_bytes(size, out);
+  }
+};
+
+// Chunk whose content is viewed in place. Children follow the content and
+// are read as the next chunks.
+struct Vox_Chunk {
+  std::string_view id;
+  std::string_view content;
+};
+
+static bool read_chunk(Vox_Reader &reader, Vox_Chunk &out) {
+  uint32_t content_size;
+  uint32_t children_size;
+  return reader.read_bytes(4, out.id) && reader.read(content_size) &&
+         reader.read(children_size) &&
+         reader.read_bytes(content_size, out.content);
 }
 
-static DICT read_dict(std::ifstream &ifs) {
-  uint32_t num_key_value_pairs;
-  ifs.read(reinterpret_cast<char *>(&num_key_value_pairs), sizeof(uint32_t));
-  assert(num_key_value_pairs >= 0);
-  DICT result;
-  if (num_key_value_pairs == 0) {
+// Key value pairs viewed in place in the file
+struct DICT {
+  std::string_view data;
+  uint32_t num_pairs = 0;
+
+  // Calls f(key, value) for every pair in order
+  template <typename F> void for_each(F &&f) const {
+    Vox_Reader reader{data};
+    std::string_view key;
+    std::string_view value;
+    for (uint32_t i = 0; i < num_pairs; i++) {
+      reader.read_string(key);
+      reader.read_string(value);
+      f(key, value);
+    }
+  }
+
+  // Value of the last pair with the key, empty if there is none
+  std::string_view get(std::string_view key) const {
+    std::string_view result;
+    for_each([&](std::string_view k, std::string_view v) {
+      if (k == key) {
+        result = v;
+      }
+    });
     return result;
   }
-  result.reserve(num_key_value_pairs);
-  for (size_t i = 0; i < num_key_value_pairs; i++) {
-    auto key = read_string(ifs);
-    auto value = read_string(ifs);
-    result[key] = value;
+};
+
+// Checks that every string of the dictionary is within the data
+static bool read_dict(Vox_Reader &reader, DICT &out) {
+  if (!reader.read(out.num_pairs)) {
+    return false;
   }
-  return result;
+  size_t begin = reader.offset;
+  std::string_view str;
+  for (uint64_t i = 0; i < 2 * uint64_t(out.num_pairs); i++) {
+    if (!reader.read_string(str)) {
+      return false;
+    }
+  }
+  out.data = reader.data.substr(begin, reader.offset - begin);
+  return true;
 }
 
-static float float_from_str(const std::string &str, float default_value) {
+static float float_from_str(std::string_view str, float default_value) {
   if (str.empty()) {
     return default_value;
   }
@@ -125,24 +191,105 @@ struct MATL_chunk {
   DICT props;
 };
 
+// Bytes that concurrently meshed models may hold in their dense grids. A
+// 256^3 model needs about 86 MB, so a wide pool cannot run many of them at
+// once.
+constexpr size_t max_meshing_bytes = size_t(1) << 30;
+
+// Memory that models reserve before meshing, a model waits until its bytes
+// fit next to those of the running ones. Larger models than the whole budget
+// run alone.
+struct Memory_Budget {
+  size_t max_bytes;
+  size_t used_bytes = 0;
+  std::mutex mutex;
+  std::condition_variable released;
+
+  void acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [&] {
+      return used_bytes == 0 || used_bytes + bytes <= max_bytes;
+    });
+    used_bytes += bytes;
+  }
+
+  void release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      used_bytes -= bytes;
+    }
+    released.notify_all();
+  }
+};
+
+// Models are meshed once the whole file is parsed, their voxels stay in the
+// mapped file
+struct XYZI_chunk {
+  const uint8_t *voxels;
+  uint32_t num_voxels;
+
+  std::array<int, 3> get_grid_size() const {
+    std::array<int, 3> grid_size = {0, 0, 0};
+    for (size_t i = 0; i < 4 * size_t(num_voxels); i += 4) {
+      for (int axis = 0; axis < 3; axis++) {
+        grid_size[axis] = std::max(grid_size[axis], voxels[i + axis] + 1);
+      }
+    }
+    return grid_size;
+  }
+};
+
+// Meshes the x, y, z and color index bytes of every voxel of a model in a
+// grid of grid_size voxels and writes the mesh to vox<model_id>.gpm. Color
+// indices must not be 0. Returns the number of distinct voxels.
+static size_t mesh_model(const uint8_t *voxels, uint32_t num_voxels,
+                         const std::array<int, 3> &grid_size, size_t model_id,
+                         bool is_greedy) {
+  Voxel_Grid grid(grid_size);
+  size_t num_unique_voxels = 0;
+  for (size_t i = 0; i < 4 * size_t(num_voxels); i += 4) {
+    num_unique_voxels +=
+        grid.set(voxels[i], voxels[i + 1], voxels[i + 2], voxels[i + 3]);
+  }
+  auto slices = find_exposed_faces(grid);
+
+  Voxel_Mesh_Builder<double> builder(grid_size);
+  if (is_greedy) {
+    greedy_mesh_voxel_faces(slices, grid_size, builder);
+  } else {
+    mesh_voxel_faces(slices, builder);
+  }
+  std::string filename_mesh = "vox" + std::to_string(model_id) + ".gpm";
+  write_gpm(filename_mesh.c_str(), builder.mesh, Gpm_Type::F32,
+            {{"color_index", Gpm_Domain::Tri, Gpm_Type::U8, 1,
+              builder.color_indices.data()}});
+  return num_unique_voxels;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Expected arguments: /path/to/input.vox" << std::endl;
+  if (count_positional_args(argc, argv) != 2) {
+    std::cerr << "Expected arguments: /path/to/input.vox [--greedy], greedy "
+                 "merges faces of one color into rectangles"
+              << std::endl;
     return 1;
   }
+  bool is_greedy = has_option(argc, argv, "greedy");
   const char *filename_vox = argv[1];
-  std::ifstream ifs_vox(filename_vox, std::ios::binary);
-  if (!ifs_vox) {
+  Mapped_File file(filename_vox);
+  if (!file.is_open) {
     std::cerr << "Failed to open file: " << filename_vox << std::endl;
     return 1;
   }
-  char magic[4];
-  ifs_vox.read(magic, 4);
+  Vox_Reader reader{std::string_view(file.data, file.size)};
+  std::string_view magic;
   uint32_t version;
-  ifs_vox.read(reinterpret_cast<char *>(&version), sizeof(uint32_t));
-
-  size_t model_id = 0;
+  if (!reader.read_bytes(4, magic) || magic != "VOX " ||
+      !reader.read(version)) {
+    std::cerr << "Not a VOX file: " << filename_vox << std::endl;
+    return 1;
+  }
 
+  std::vector<XYZI_chunk> xyzi_chunks;
   std::vector<MATL_chunk> matl_chunks;
   matl_chunks.reserve(256);
   PBR_Material pbr_materials[256];
@@ -191,169 +338,101 @@ int main(int argc, char *argv[]) {
       0xffeeeeee, 0xffdddddd, 0xffbbbbbb, 0xffaaaaaa, 0xff888888, 0xff777777,
       0xff555555, 0xff444444, 0xff222222, 0xff111111};
 
-  char chunk_id[4];
-  uint32_t chunk_size;
-  uint32_t child_chunk_size;
-  while (ifs_vox.read(chunk_id, 4)) {
-    ifs_vox.read(reinterpret_cast<char *>(&chunk_size), sizeof(uint32_t));
-    ifs_vox.read(reinterpret_cast<char *>(&child_chunk_size), sizeof(uint32_t));
-    if (std::string_view(chunk_id, 4) == "XYZI") {
+  while (reader.offset < reader.data.size()) {
+    Vox_Chunk chunk;
+    if (!read_chunk(reader, chunk)) {
+      std::cerr << "Truncated VOX file: " << filename_vox << std::endl;
+      return 1;
+    }
+    Vox_Reader content{chunk.content};
+    bool is_valid = true;
+    if (chunk.id == "XYZI") {
       uint32_t num_voxels;
-      ifs_vox.read(reinterpret_cast<char *>(&num_voxels), sizeof(uint32_t));
-      uint8_t *voxels = (uint8_t *)malloc(4 * num_voxels);
-      ifs_vox.read(reinterpret_cast<char *>(voxels), 4 * num_voxels);
-
-      std::vector<Triangle<double>> tris;
-      std::vector<uint8_t> color_indices;
-
-      std::unordered_map<Vec3<double>, uint8_t> dense_voxels;
-      dense_voxels.reserve(num_voxels);
-
-      for (size_t i = 0; i < 4 * num_voxels; i += 4) {
-        auto x = (double)voxels[i];
-        auto y = (double)voxels[i + 1];
-        auto z = (double)voxels[i + 2];
-        auto color_index = voxels[i + 3];
-        assert(color_index > 0);
-        dense_voxels.insert({Vec3<double>{x, y, z}, color_index});
+      std::string_view voxels;
+      is_valid = content.read(num_voxels) &&
+                 content.read_bytes(4 * size_t(num_voxels), voxels);
+      // Color index 0 is empty space
+      for (size_t i = 3; is_valid && i < voxels.size(); i += 4) {
+        is_valid = voxels[i] != 0;
       }
-      free(voxels);
-      std::cout << dense_voxels.size() << " " << num_voxels << std::endl;
-      assert(dense_voxels.size() == num_voxels);
-      for (const auto &[key, value] : dense_voxels) {
-        auto x = key.x;
-        auto y = key.y;
-        auto z = key.z;
-        auto color_index = value;
-        // -x
-        auto it = dense_voxels.find({x - 1, y, z});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x, y, z}, {x, y, z + 1}, {x, y + 1, z}});
-          tris.push_back({{x, y + 1, z}, {x, y, z + 1}, {x, y + 1, z + 1}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-        // x
-        it = dense_voxels.find({x + 1, y, z});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x + 1, y, z}, {x + 1, y + 1, z}, {x + 1, y, z + 1}});
-          tris.push_back(
-              {{x + 1, y + 1, z}, {x + 1, y + 1, z + 1}, {x + 1, y, z + 1}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-        // -y
-        it = dense_voxels.find({x, y - 1, z});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x, y, z}, {x + 1, y, z}, {x, y, z + 1}});
-          tris.push_back({{x, y, z + 1}, {x + 1, y, z}, {x + 1, y, z + 1}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-        // y
-        it = dense_voxels.find({x, y + 1, z});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x, y + 1, z}, {x, y + 1, z + 1}, {x + 1, y + 1, z}});
-          tris.push_back(
-              {{x, y + 1, z + 1}, {x + 1, y + 1, z + 1}, {x + 1, y + 1, z}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-        // -z
-        it = dense_voxels.find({x, y, z - 1});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x, y, z}, {x, y + 1, z}, {x + 1, y, z}});
-          tris.push_back({{x + 1, y, z}, {x, y + 1, z}, {x + 1, y + 1, z}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-        // +z
-        it = dense_voxels.find({x, y, z + 1});
-        if (it == dense_voxels.end()) {
-          tris.push_back({{x, y, z + 1}, {x + 1, y, z + 1}, {x, y + 1, z + 1}});
-          tris.push_back(
-              {{x + 1, y, z + 1}, {x + 1, y + 1, z + 1}, {x, y + 1, z + 1}});
-          color_indices.push_back(color_index);
-          color_indices.push_back(color_index);
-        }
-      }
-
-      auto mesh = Indexed_Tri_Mesh<double>::from_stl_tris(tris);
-
-      std::string filename_vertices =
-          "vox" + std::to_string(model_id) + "_vertices.bin";
-      std::ofstream ofs_vertices(filename_vertices, std::ios::binary | std::ios::trunc);
-      for (const auto &v : mesh.vertices) {
-        auto vf = v.as<float>();
-        ofs_vertices.write(reinterpret_cast<const char *>(&vf),
-                           sizeof(Vec3<float>));
+      if (is_valid) {
+        xyzi_chunks.push_back(
+            {reinterpret_cast<const uint8_t *>(voxels.data()), num_voxels});
       }
-
-      std::string filename_tris =
-          "vox" + std::to_string(model_id) + "_tris.bin";
-      std::ofstream ofs_tris(filename_tris, std::ios::binary | std::ios::trunc);
-      ofs_tris.write(reinterpret_cast<const char *>(mesh.tris.data()),
-                     mesh.tris.size() * sizeof(uint32_t[3]));
-
-      std::string filename_color_indices =
-          "vox" + std::to_string(model_id) + "_color_indices.bin";
-      std::ofstream ofs_color_indices(filename_color_indices, std::ios::binary | std::ios::trunc);
-      ofs_color_indices.write(
-          reinterpret_cast<const char *>(color_indices.data()),
-          color_indices.size() * sizeof(uint8_t));
-
-      assert(mesh.tris.size() == color_indices.size());
-      model_id++;
-    } else if (std::string_view(chunk_id, 4) == "MATL") {
+    } else if (chunk.id == "MATL") {
       std::cout << "Found MATL chunk!" << std::endl;
       uint32_t material_id;
-      auto f1 = ifs_vox.tellg();
-      ifs_vox.read(reinterpret_cast<char *>(&material_id), sizeof(uint32_t));
-      assert(material_id > 0);
-      std::cout << "Material ID: " << material_id << std::endl;
-      auto material_properties = read_dict(ifs_vox);
-      for (const auto &[key, value] : material_properties) {
-        std::cout << "Material property: " << key << " = " << value
-                  << std::endl;
+      DICT material_properties;
+      is_valid = content.read(material_id) &&
+                 read_dict(content, material_properties) &&
+                 content.offset == chunk.content.size() && material_id > 0 &&
+                 material_id <= 256;
+      if (is_valid) {
+        std::cout << "Material ID: " << material_id << std::endl;
+        material_properties.for_each(
+            [](std::string_view key, std::string_view value) {
+              std::cout << "Material property: " << key << " = " << value
+                        << std::endl;
+            });
+        matl_chunks.push_back({material_id, material_properties});
       }
-      matl_chunks.push_back({material_id, material_properties});
-      auto f2 = ifs_vox.tellg();
-      assert(f2 - f1 == chunk_size);
-    } else if (std::string_view(chunk_id, 4) == "MATT") {
-
+    } else if (chunk.id == "MATT") {
       std::cout << "Found MATT chunk!" << std::endl;
-      auto f1 = ifs_vox.tellg();
       uint32_t material_id;
-      ifs_vox.read(reinterpret_cast<char *>(&material_id), sizeof(uint32_t));
-      assert(material_id > 0);
-      std::cout << "Material ID: " << material_id << std::endl;
       uint32_t material_type;
-      ifs_vox.read(reinterpret_cast<char *>(&material_type), sizeof(uint32_t));
       float material_weight;
-      ifs_vox.read(reinterpret_cast<char *>(&material_weight), sizeof(float));
-
       Matt_Property_Bits property_bits;
-      ifs_vox.read(reinterpret_cast<char *>(&property_bits),
-                   sizeof(Matt_Property_Bits));
-
-      auto n = std::bitset<8>(property_bits.bits).count();
-      float *properties = (float *)malloc(sizeof(float) * n);
-      ifs_vox.read(reinterpret_cast<char *>(properties), sizeof(float) * n);
-
-      // TODO: store material properties and use them to set PBR values for each
-      // material.
-
-      auto f2 = ifs_vox.tellg();
-      assert(f2 - f1 == chunk_size);
-    } else if (std::string_view(chunk_id, 4) == "RGBA") {
+      std::string_view properties;
+      is_valid = content.read(material_id) && content.read(material_type) &&
+                 content.read(material_weight) &&
+                 content.read(property_bits) && material_id > 0 &&
+                 material_id <= 256;
+      if (is_valid) {
+        std::cout << "Material ID: " << material_id << std::endl;
+        auto n = std::bitset<8>(property_bits.bits).count();
+        is_valid = content.read_bytes(sizeof(float) * n, properties) &&
+                   content.offset == chunk.content.size();
+
+        // TODO: store material properties and use them to set PBR values for
+        // each material.
+      }
+    } else if (chunk.id == "RGBA") {
       std::cout << "Found RGBA chunk!" << std::endl;
-      auto f1 = ifs_vox.tellg();
-      ifs_vox.read(reinterpret_cast<char *>(palette + 1), sizeof(RGBA) * 255);
-      ifs_vox.seekg(sizeof(RGBA), std::ios::cur);
-      auto f2 = ifs_vox.tellg();
-      assert(f2 - f1 == chunk_size);
-    } else {
-      ifs_vox.seekg(chunk_size, std::ios::cur);
+      is_valid = chunk.content.size() == sizeof(RGBA) * 256;
+      if (is_valid) {
+        std::memcpy(palette + 1, chunk.content.data(), sizeof(RGBA) * 255);
+      }
+    }
+    if (!is_valid) {
+      std::cerr << "Invalid " << chunk.id << " chunk in " << filename_vox
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // Models are meshed concurrently as far as their dense grids fit in the
+  // budget, nested parallel loops run serially within them
+  std::vector<size_t> num_unique_voxels(xyzi_chunks.size());
+  Memory_Budget budget{max_meshing_bytes};
+  parallel_for(
+      xyzi_chunks.size(),
+      [&](size_t model_id) {
+        const auto &chunk = xyzi_chunks[model_id];
+        auto grid_size = chunk.get_grid_size();
+        size_t bytes = get_voxel_grid_bytes(grid_size);
+        budget.acquire(bytes);
+        num_unique_voxels[model_id] = mesh_model(
+            chunk.voxels, chunk.num_voxels, grid_size, model_id, is_greedy);
+        budget.release(bytes);
+      },
+      1);
+  for (size_t model_id = 0; model_id < xyzi_chunks.size(); model_id++) {
+    std::cout << num_unique_voxels[model_id] << " "
+              << xyzi_chunks[model_id].num_voxels << std::endl;
+    if (num_unique_voxels[model_id] != xyzi_chunks[model_id].num_voxels) {
+      std::cerr << "Duplicate voxels in model " << model_id << " of "
+                << filename_vox << std::endl;
+      return 1;
     }
   }
 
@@ -371,22 +450,27 @@ int main(int argc, char *argv[]) {
   }
 
   // Set material properties from MATL chunks
-  assert(matl_chunks.size() == 256);
+  if (matl_chunks.size() != 256) {
+    std::cerr << "Expected 256 MATL chunks, found " << matl_chunks.size()
+              << " in " << filename_vox << std::endl;
+    return 1;
+  }
   for (auto &matl_chunk : matl_chunks) {
     if (matl_chunk.id == 256) {
       continue;
     }
     auto &pbr_mat = pbr_materials[matl_chunk.id];
-    pbr_mat.metallic = float_from_str(matl_chunk.props["_metal"], 0.0f);
-    pbr_mat.roughness = float_from_str(matl_chunk.props["_rough"], 0.0f);
-    pbr_mat.ior = float_from_str(matl_chunk.props["_ri"], 1.3f);
-    pbr_mat.transmission = float_from_str(matl_chunk.props["_trans"], 0.0f);
-    pbr_mat.emission = float_from_str(matl_chunk.props["_emit"], 0.0f);
-    pbr_mat.emission_power = float_from_str(matl_chunk.props["_flux"], 0.0f);
-    pbr_mat.density = float_from_str(matl_chunk.props["_d"], 0.0f);
-    pbr_mat.phase = float_from_str(matl_chunk.props["_g"], 0.0f);
-
-    auto type = matl_chunk.props["_type"];
+    const auto &props = matl_chunk.props;
+    pbr_mat.metallic = float_from_str(props.get("_metal"), 0.0f);
+    pbr_mat.roughness = float_from_str(props.get("_rough"), 0.0f);
+    pbr_mat.ior = float_from_str(props.get("_ri"), 1.3f);
+    pbr_mat.transmission = float_from_str(props.get("_trans"), 0.0f);
+    pbr_mat.emission = float_from_str(props.get("_emit"), 0.0f);
+    pbr_mat.emission_power = float_from_str(props.get("_flux"), 0.0f);
+    pbr_mat.density = float_from_str(props.get("_d"), 0.0f);
+    pbr_mat.phase = float_from_str(props.get("_g"), 0.0f);
+
+    auto type = props.get("_type");
     if (type == "_blend") {
       pbr_mat.surface_type = PBR_Surface_Material_Type::Blend;
     } else if (type == "_glass") {
@@ -400,7 +484,7 @@ int main(int argc, char *argv[]) {
     } else if (type == "_media") {
       pbr_mat.surface_type = PBR_Surface_Material_Type::Cloud;
     }
-    auto media_type = matl_chunk.props["_media_type"];
+    auto media_type = props.get("_media_type");
     if (media_type == "_scatter") {
       pbr_mat.volume_type = PBR_Volume_Material_Type::Scatter;
     } else if (media_type == "_emit") {
@@ -412,7 +496,8 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  std::ofstream ofs_pbr("pbr_materials.bin", std::ios::binary | std::ios::trunc);
+  std::ofstream ofs_pbr("pbr_materials.bin",
+                        std::ios::binary | std::ios::trunc);
   ofs_pbr.write(reinterpret_cast<const char *>(pbr_materials),
                 sizeof(PBR_Material) * 256);
 }
\ No newline at end of file
@@ -6,7 +6,7 @@ template <typename T> struct AABB {
   Vec3<T> min;
   Vec3<T> max;
 
-  AABB() : min(Vec3<T>(0.0)), max(Vec3<T>(0.0)) {}
+  AABB() : min(Vec3<T>(0, 0, 0)), max(Vec3<T>(0, 0, 0)) {}
   AABB(const Vec3<T> &min, const Vec3<T> &max) : min(min), max(max) {}
   AABB join(const AABB &other) const {
     return AABB{min.min(other.min), max.max(other.max)};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Walker/Vose alias table for O(1) sampling of a discrete distribution:
+// https://www.keithschwarz.com/darts-dice-coins/
+struct Alias_Table {
+  // Probability of keeping column i instead of jumping to aliases[i]
+  std::vector<double> probs;
+  std::vector<uint32_t> aliases;
+  double total_weight = 0.0;
+
+  // Scaling the weights and splitting columns into small and large ones runs
+  // in parallel, only the final O(n) pairing of columns is serial.
+  static Alias_Table build(const std::vector<double> &weights) {
+    constexpr size_t block_size = 1 << 16;
+    const size_t n = weights.size();
+    const size_t num_blocks = (n + block_size - 1) / block_size;
+    Alias_Table table;
+    if (n == 0) {
+      return table;
+    }
+
+    // Sum per block, then combine in block order so the total does not depend
+    // on the number of threads.
+    std::vector<double> block_sums(num_blocks, 0.0);
+    parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                           size_t end) {
+      double sum = 0.0;
+      for (size_t i = begin; i < end; i++) {
+        sum += weights[i];
+      }
+      block_sums[block] = sum;
+    });
+    for (double s : block_sums) {
+      table.total_weight += s;
+    }
+
+    table.probs.resize(n);
+    table.aliases.resize(n);
+    std::vector<size_t> block_num_small(num_blocks, 0);
+    const double scale = double(n) / table.total_weight;
+    parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                           size_t end) {
+      size_t num_small = 0;
+      for (size_t i = begin; i < end; i++) {
+        table.probs[i] = weights[i] * scale;
+        table.aliases[i] = uint32_t(i);
+        num_small += table.probs[i] < 1.0;
+      }
+      block_num_small[block] = num_small;
+    });
+
+    // Stable partition of column indices into small and large worklists
+    std::vector<size_t> block_small_offsets(num_blocks, 0);
+    std::vector<size_t> block_large_offsets(num_blocks, 0);
+    size_t num_small = 0;
+    for (size_t block = 0; block < num_blocks; block++) {
+      block_small_offsets[block] = num_small;
+      block_large_offsets[block] = block * block_size - num_small;
+      num_small += block_num_small[block];
+    }
+    std::vector<uint32_t> small(num_small);
+    std::vector<uint32_t> large(n - num_small);
+    parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                           size_t end) {
+      size_t small_offset = block_small_offsets[block];
+      size_t large_offset = block_large_offsets[block];
+      for (size_t i = begin; i < end; i++) {
+        if (table.probs[i] < 1.0) {
+          small[small_offset++] = uint32_t(i);
+        } else {
+          large[large_offset++] = uint32_t(i);
+        }
+      }
+    });
+
+    // Vose's pairing, the large worklist is used as a stack
+    size_t small_idx = 0;
+    while (small_idx < small.size() && !large.empty()) {
+      uint32_t s = small[small_idx++];
+      uint32_t l = large.back();
+      table.aliases[s] = l;
+      table.probs[l] = (table.probs[l] + table.probs[s]) - 1.0;
+      if (table.probs[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // Leftovers are only off from 1 due to rounding errors
+    for (; small_idx < small.size(); small_idx++) {
+      table.probs[small[small_idx]] = 1.0;
+    }
+    for (uint32_t l : large) {
+      table.probs[l] = 1.0;
+    }
+    return table;
+  }
+
+  size_t size() const { return probs.size(); }
+
+  // Maps a uniform random number in [0, 1) to a column index, the fractional
+  // part of u * n decides between the column and its alias.
+  uint32_t sample(double u) const {
+    double x = u * double(probs.size());
+    size_t i = std::min(size_t(x), probs.size() - 1);
+    return (x - double(i)) < probs[i] ? uint32_t(i) : aliases[i];
+  }
+};
@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <initializer_list>
+#include <limits>
 #include <vector>
 
 #include "aabb.hpp"
@@ -93,6 +95,67 @@ bool intersect_ray_aabb(const Ray<T> &ray, const AABB<T> &aabb) {
   return true;
 }
 
+template <typename T, typename U>
+T calc_aabb_distance_squared(const AABB<U> &aabb, const Vec3<T> &point) {
+  T distance_squared = 0;
+  for (int i = 0; i < 3; i++) {
+    T d = std::max(
+        {T(aabb.min[i]) - point[i], T(0), point[i] - T(aabb.max[i])});
+    distance_squared += d * d;
+  }
+  return distance_squared;
+}
+
+// Closest point on a triangle by Voronoi regions, from Ericson's Real-Time
+// Collision Detection
+template <typename T>
+Vec3<T> calc_closest_point_on_triangle(const Triangle<T> &tri,
+                                       const Vec3<T> &point) {
+  const Vec3<T> ab = tri.b - tri.a;
+  const Vec3<T> ac = tri.c - tri.a;
+  const Vec3<T> ap = point - tri.a;
+  const T d1 = ab.dot(ap);
+  const T d2 = ac.dot(ap);
+  if (d1 <= 0 && d2 <= 0) {
+    return tri.a;
+  }
+  const Vec3<T> bp = point - tri.b;
+  const T d3 = ab.dot(bp);
+  const T d4 = ac.dot(bp);
+  if (d3 >= 0 && d4 <= d3) {
+    return tri.b;
+  }
+  const T vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return tri.a + ab * (d1 / (d1 - d3));
+  }
+  const Vec3<T> cp = point - tri.c;
+  const T d5 = ab.dot(cp);
+  const T d6 = ac.dot(cp);
+  if (d6 >= 0 && d5 <= d6) {
+    return tri.c;
+  }
+  const T vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return tri.a + ac * (d2 / (d2 - d6));
+  }
+  const T va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+    return tri.b + (tri.c - tri.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  const T sum = va + vb + vc;
+  if (sum <= 0) {
+    // Degenerate triangle, its neighbours cover its edges
+    return tri.a;
+  }
+  return tri.a + ab * (vb / sum) + ac * (vc / sum);
+}
+
+template <typename T> struct Closest_Triangle {
+  T distance_squared = std::numeric_limits<T>::infinity();
+  uint32_t tri_idx = 0;
+};
+
 struct BVH {
 public:
   BVH_Node *nodes;
@@ -153,6 +216,43 @@ private:
     }
   }
 
+  template <typename T>
+  void find_closest_tri(const Vec3<T> &point,
+                        const std::vector<Triangle<T>> &tris,
+                        uint32_t node_idx, T min_distance_squared,
+                        Closest_Triangle<T> &closest) {
+    if (closest.distance_squared < min_distance_squared) {
+      return;
+    }
+    BVH_Node &node = nodes[node_idx];
+    if (node.is_leaf()) {
+      for (uint32_t i = 0; i < node.prim_count; i++) {
+        auto tri_idx = indices[node.left_first + i];
+        auto p = calc_closest_point_on_triangle(tris[tri_idx], point);
+        T distance_squared = (p - point).length_squared();
+        if (distance_squared < closest.distance_squared) {
+          closest.distance_squared = distance_squared;
+          closest.tri_idx = tri_idx;
+        }
+      }
+      return;
+    }
+    // Visit the nearer child first so the farther one is more likely culled
+    uint32_t children[2] = {node.left_first, node.left_first + 1};
+    T distances_squared[2];
+    for (int i = 0; i < 2; i++) {
+      distances_squared[i] =
+          calc_aabb_distance_squared(nodes[children[i]].aabb, point);
+    }
+    int first = distances_squared[1] < distances_squared[0];
+    for (int i : {first, 1 - first}) {
+      if (distances_squared[i] < closest.distance_squared) {
+        find_closest_tri(point, tris, children[i], min_distance_squared,
+                         closest);
+      }
+    }
+  }
+
 public:
   void free() { _aligned_free(nodes); }
 
@@ -171,6 +271,24 @@ public:
     count_intersections(ray, tris, 0, num_intersections);
     return num_intersections;
   }
+
+  // Branch and bound search for the triangle closest to point. Triangles
+  // farther than max_distance are skipped, and if there are only such
+  // triangles the result keeps an infinite distance. The search stops at the
+  // first triangle closer than min_distance, which need not be the closest.
+  template <typename T>
+  Closest_Triangle<T>
+  find_closest_tri(const Vec3<T> &point, const std::vector<Triangle<T>> &tris,
+                   T max_distance = std::numeric_limits<T>::infinity(),
+                   T min_distance = 0) {
+    Closest_Triangle<T> closest;
+    closest.distance_squared = max_distance * max_distance;
+    find_closest_tri(point, tris, 0, min_distance * min_distance, closest);
+    if (closest.distance_squared == max_distance * max_distance) {
+      closest.distance_squared = std::numeric_limits<T>::infinity();
+    }
+    return closest;
+  }
 };
 
 BVH build_bvh(const std::vector<AABB<float>> &aabbs) {
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstring>
+
+// Optional arguments are passed as "--name=value" after the positional ones.
+
+inline bool is_option(const char *arg) {
+  return std::strncmp(arg, "--", 2) == 0;
+}
+
+// Number of arguments, including the program name, that are not options.
+inline int count_positional_args(int argc, char *argv[]) {
+  int count = 0;
+  for (int i = 0; i < argc; i++) {
+    if (!is_option(argv[i])) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Returns the value of "--name=value", or default_value if the option is not
+// given. A bare "--name" returns an empty string.
+inline const char *get_option(int argc, char *argv[], const char *name,
+                              const char *default_value) {
+  size_t name_size = std::strlen(name);
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!is_option(arg) || std::strncmp(arg + 2, name, name_size) != 0) {
+      continue;
+    }
+    const char *rest = arg + 2 + name_size;
+    if (*rest == '=') {
+      return rest + 1;
+    }
+    if (*rest == '\0') {
+      return rest;
+    }
+  }
+  return default_value;
+}
+
+inline bool has_option(int argc, char *argv[], const char *name) {
+  return get_option(argc, argv, name, nullptr) != nullptr;
+}
@@ -0,0 +1,576 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "indexed_tri_edges_mesh.hpp"
+#include "indexed_tri_mesh.hpp"
+#include "mesh_adjacency.hpp"
+#include "mesh_islands.hpp"
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+#include "vec3.hpp"
+
+// Garland and Heckbert's quadric error metric, the weighted sum of squared
+// distances to a set of planes as a symmetric 4x4 matrix
+template <typename T> struct Quadric {
+  // xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+  std::array<T, 10> m{};
+
+  // Plane n.p + d = 0 with a unit normal
+  static Quadric from_plane(const Vec3<T> &n, T d, T weight) {
+    Quadric q;
+    q.m = {n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y,
+           n.y * n.z, n.y * d,   n.z * n.z, n.z * d, d * d};
+    for (auto &v : q.m) {
+      v *= weight;
+    }
+    return q;
+  }
+
+  void operator+=(const Quadric &other) {
+    for (int i = 0; i < 10; i++) {
+      m[i] += other.m[i];
+    }
+  }
+
+  T evaluate(const Vec3<T> &p) const {
+    return m[0] * p.x * p.x + m[4] * p.y * p.y + m[7] * p.z * p.z +
+           2 * (m[1] * p.x * p.y + m[2] * p.x * p.z + m[5] * p.y * p.z) +
+           2 * (m[3] * p.x + m[6] * p.y + m[8] * p.z) + m[9];
+  }
+
+  // Point of least error, false if the planes do not pin down a point
+  bool find_minimum(Vec3<T> &out) const {
+    T a = m[0], b = m[1], c = m[2], d = m[4], e = m[5], f = m[7];
+    T inv00 = d * f - e * e, inv01 = c * e - b * f, inv02 = b * e - c * d;
+    T inv11 = a * f - c * c, inv12 = b * c - a * e, inv22 = a * d - b * b;
+    T det = a * inv00 + b * inv01 + c * inv02;
+    T trace = a + d + f;
+    if (!(std::abs(det) > T(1e-10) * trace * trace * trace)) {
+      return false;
+    }
+    out = Vec3<T>(inv00 * m[3] + inv01 * m[6] + inv02 * m[8],
+                  inv01 * m[3] + inv11 * m[6] + inv12 * m[8],
+                  inv02 * m[3] + inv12 * m[6] + inv22 * m[8]) /
+          -det;
+    return true;
+  }
+};
+
+// Patch of vertices that touch triangles of several patches, which do not
+// move during the parallel pass
+constexpr uint32_t locked_patch = std::numeric_limits<uint32_t>::max();
+
+// Triangle mesh under edge collapses. Removed triangles stay in place and are
+// flagged, the triangle lists of vertices drop them lazily.
+template <typename T> struct Decimation_Mesh {
+  std::vector<Vec3<T>> vertices;
+  Tri_List tris;
+  std::vector<uint8_t> is_removed_tri;
+  std::vector<std::vector<uint32_t>> vertex_tris;
+  std::vector<Quadric<T>> quadrics;
+  // Bumped whenever a vertex moves or is removed, queued collapses of its
+  // edges are stale once it differs
+  std::vector<uint32_t> versions;
+  std::vector<uint8_t> is_boundary_vertex;
+  std::vector<uint32_t> vertex_patches;
+  // Edges of the input mesh
+  std::vector<Undirected_Edge> edges;
+};
+
+template <typename T> struct Edge_Collapse {
+  T cost;
+  uint32_t v0, v1;
+  uint32_t version0, version1;
+  Vec3<T> position;
+
+  // Cheapest first in a std::priority_queue
+  bool operator<(const Edge_Collapse &other) const {
+    return cost > other.cost;
+  }
+};
+
+// Boundary edges get planes through them perpendicular to their triangle,
+// weighted by this factor times the squared edge length, which keeps
+// boundaries in place
+constexpr double boundary_quadric_weight = 100;
+
+template <typename T>
+Decimation_Mesh<T> make_decimation_mesh(const Indexed_Tri_Mesh<T> &mesh) {
+  Decimation_Mesh<T> out;
+  const size_t num_vertices = mesh.vertices.size();
+  const size_t num_tris = mesh.tris.size();
+  out.vertices = mesh.vertices;
+  out.tris = mesh.tris;
+  out.is_removed_tri.assign(num_tris, 0);
+  out.versions.assign(num_vertices, 0);
+  out.vertex_patches.assign(num_vertices, 0);
+
+  auto edges_mesh = Indexed_Tri_Edges_Mesh<T>::from_indexed_mesh(mesh);
+  std::vector<std::atomic<uint32_t>> edge_num_tris(edges_mesh.edges.size());
+  parallel_for(edges_mesh.edges.size(), [&](size_t i) {
+    edge_num_tris[i].store(0, std::memory_order_relaxed);
+  });
+  parallel_for(num_tris, [&](size_t i) {
+    for (auto e : edges_mesh.tris[i]) {
+      edge_num_tris[e].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  // Area weighted plane of every triangle, and boundary planes of its edges
+  std::vector<Quadric<T>> tri_quadrics(num_tris);
+  std::vector<std::array<Quadric<T>, 3>> edge_quadrics(num_tris);
+  parallel_for(num_tris, [&](size_t i) {
+    const auto &t = mesh.tris[i];
+    const auto &p = mesh.vertices;
+    auto n = (p[t[1]] - p[t[0]]).cross(p[t[2]] - p[t[0]]);
+    T double_area = n.length();
+    if (double_area > 0) {
+      n = n / double_area;
+      tri_quadrics[i] = Quadric<T>::from_plane(n, -n.dot(p[t[0]]),
+                                               double_area / T(2));
+    }
+    for (int k = 0; k < 3; k++) {
+      if (edge_num_tris[edges_mesh.tris[i][k]].load(
+              std::memory_order_relaxed) != 1) {
+        continue;
+      }
+      auto edge = p[t[(k + 1) % 3]] - p[t[k]];
+      auto m = edge.cross(n);
+      T length = m.length();
+      if (length > 0) {
+        m = m / length;
+        edge_quadrics[i][k] = Quadric<T>::from_plane(
+            m, -m.dot(p[t[k]]),
+            T(boundary_quadric_weight) * edge.length_squared());
+      }
+    }
+  });
+
+  // Gathered per vertex in triangle order, independent of the thread count
+  auto vertex_tris = build_vertex_face_adjacency(mesh.tris, num_vertices);
+  out.vertex_tris.resize(num_vertices);
+  out.quadrics.resize(num_vertices);
+  out.is_boundary_vertex.assign(num_vertices, 0);
+  parallel_for(num_vertices, [&](size_t v) {
+    auto tris = vertex_tris[v];
+    out.vertex_tris[v].assign(tris.begin(), tris.end());
+    for (auto ti : tris) {
+      out.quadrics[v] += tri_quadrics[ti];
+      for (int k = 0; k < 3; k++) {
+        const auto &t = mesh.tris[ti];
+        bool has_vertex = t[k] == v || t[(k + 1) % 3] == v;
+        if (has_vertex && edge_num_tris[edges_mesh.tris[ti][k]].load(
+                              std::memory_order_relaxed) == 1) {
+          out.quadrics[v] += edge_quadrics[ti][k];
+          out.is_boundary_vertex[v] = 1;
+        }
+      }
+    }
+  });
+  out.edges = std::move(edges_mesh.edges);
+  return out;
+}
+
+template <typename T>
+Edge_Collapse<T> calc_edge_collapse(const Decimation_Mesh<T> &mesh,
+                                    uint32_t v0, uint32_t v1) {
+  Quadric<T> q = mesh.quadrics[v0];
+  q += mesh.quadrics[v1];
+  Edge_Collapse<T> collapse{0, v0, v1, mesh.versions[v0], mesh.versions[v1],
+                            mesh.vertices[v0]};
+  const auto &a = mesh.vertices[v0];
+  const auto &b = mesh.vertices[v1];
+  auto midpoint = (a + b) / T(2);
+  // Nearly parallel planes, such as those of few triangles on a smooth
+  // surface, put the minimum far along the surface and off it
+  Vec3<T> minimum(0, 0, 0);
+  if (q.find_minimum(minimum) && (minimum - midpoint).length_squared() <=
+                                     (b - a).length_squared()) {
+    collapse.position = minimum;
+    collapse.cost = q.evaluate(minimum);
+  } else {
+    // Best of the end points and the midpoint
+    collapse.cost = std::numeric_limits<T>::infinity();
+    for (const auto &p : {a, b, midpoint}) {
+      T cost = q.evaluate(p);
+      if (cost < collapse.cost) {
+        collapse.cost = cost;
+        collapse.position = p;
+      }
+    }
+  }
+  collapse.cost = std::max(collapse.cost, T(0));
+  return collapse;
+}
+
+// Scratch buffers of one thread
+struct Collapse_Scratch {
+  std::vector<uint32_t> neighbours0, neighbours1, tris;
+};
+
+// Collapses v1 into v0 unless that changes the topology, joins two boundaries,
+// leaves duplicate triangles or turns a triangle by more than about 80
+// degrees. Returns the number of removed triangles.
+template <typename T>
+int try_edge_collapse(Decimation_Mesh<T> &mesh, const Edge_Collapse<T> &c,
+                      Collapse_Scratch &scratch) {
+  const uint32_t v0 = c.v0, v1 = c.v1;
+  auto &tris0 = mesh.vertex_tris[v0];
+  auto &tris1 = mesh.vertex_tris[v1];
+  auto is_removed = [&](uint32_t t) { return mesh.is_removed_tri[t] != 0; };
+  tris0.erase(std::remove_if(tris0.begin(), tris0.end(), is_removed),
+              tris0.end());
+  tris1.erase(std::remove_if(tris1.begin(), tris1.end(), is_removed),
+              tris1.end());
+
+  auto has_vertex = [&](uint32_t t, uint32_t v) {
+    const auto &tri = mesh.tris[t];
+    return tri[0] == v || tri[1] == v || tri[2] == v;
+  };
+  auto gather_neighbours = [&](const std::vector<uint32_t> &tris,
+                               uint32_t other, std::vector<uint32_t> &out) {
+    out.clear();
+    for (auto t : tris) {
+      for (auto v : mesh.tris[t]) {
+        out.push_back(v);
+      }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    out.erase(std::remove(out.begin(), out.end(), other), out.end());
+  };
+  int num_shared = 0;
+  for (auto t : tris0) {
+    num_shared += has_vertex(t, v1);
+  }
+  if (num_shared == 0 || num_shared > 2 ||
+      (num_shared == 2 && mesh.is_boundary_vertex[v0] &&
+       mesh.is_boundary_vertex[v1])) {
+    return 0;
+  }
+  // Link condition, the only common neighbours are the opposite corners of
+  // the shared triangles
+  gather_neighbours(tris0, v0, scratch.neighbours0);
+  gather_neighbours(tris1, v1, scratch.neighbours1);
+  size_t num_common = 0;
+  for (size_t i = 0, j = 0;
+       i < scratch.neighbours0.size() && j < scratch.neighbours1.size();) {
+    uint32_t a = scratch.neighbours0[i], b = scratch.neighbours1[j];
+    num_common += a == b;
+    i += a <= b;
+    j += b <= a;
+  }
+  if (num_common != size_t(num_shared)) {
+    return 0;
+  }
+  // Triangles of both vertices on the opposite corners of the shared
+  // triangles would become duplicates, which is how a tetrahedron collapses
+  if (num_shared == 2) {
+    std::array<uint32_t, 2> opposite;
+    int num_opposite = 0;
+    for (auto t : tris0) {
+      if (has_vertex(t, v1)) {
+        for (auto v : mesh.tris[t]) {
+          if (v != v0 && v != v1) {
+            opposite[num_opposite++] = v;
+          }
+        }
+      }
+    }
+    auto has_opposite_tri = [&](const std::vector<uint32_t> &tris) {
+      for (auto t : tris) {
+        if (has_vertex(t, opposite[0]) && has_vertex(t, opposite[1])) {
+          return true;
+        }
+      }
+      return false;
+    };
+    if (has_opposite_tri(tris0) && has_opposite_tri(tris1)) {
+      return 0;
+    }
+  }
+
+  for (const auto *tris : {&tris0, &tris1}) {
+    for (auto t : *tris) {
+      if (has_vertex(t, v0) && has_vertex(t, v1)) {
+        continue;
+      }
+      const auto &tri = mesh.tris[t];
+      Vec3<T> p[3] = {mesh.vertices[tri[0]], mesh.vertices[tri[1]],
+                      mesh.vertices[tri[2]]};
+      auto old_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+      for (int k = 0; k < 3; k++) {
+        if (tri[k] == v0 || tri[k] == v1) {
+          p[k] = c.position;
+        }
+      }
+      auto new_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+      T old_length = old_normal.length();
+      if (old_length > 0 && new_normal.dot(old_normal) <=
+                                T(0.2) * new_normal.length() * old_length) {
+        return 0;
+      }
+    }
+  }
+
+  scratch.tris.clear();
+  for (auto t : tris0) {
+    if (has_vertex(t, v1)) {
+      mesh.is_removed_tri[t] = 1;
+    } else {
+      scratch.tris.push_back(t);
+    }
+  }
+  for (auto t : tris1) {
+    if (mesh.is_removed_tri[t]) {
+      continue;
+    }
+    for (auto &v : mesh.tris[t]) {
+      if (v == v1) {
+        v = v0;
+      }
+    }
+    scratch.tris.push_back(t);
+  }
+  tris0.swap(scratch.tris);
+  tris1.clear();
+  tris1.shrink_to_fit();
+  mesh.vertices[v0] = c.position;
+  mesh.quadrics[v0] += mesh.quadrics[v1];
+  mesh.is_boundary_vertex[v0] |= mesh.is_boundary_vertex[v1];
+  mesh.versions[v0]++;
+  mesh.versions[v1]++;
+  return num_shared;
+}
+
+// Collapses the cheapest edges between vertices of the patch until
+// max_removed triangles are gone or no edge can be collapsed. The queue is
+// updated lazily, collapses of moved vertices are dropped when they come up
+// and the vertex's edges are queued again after every collapse.
+template <typename T>
+size_t decimate_patch(Decimation_Mesh<T> &mesh,
+                      const std::vector<std::array<uint32_t, 2>> &edges,
+                      uint32_t patch, size_t max_removed) {
+  std::priority_queue<Edge_Collapse<T>> queue;
+  for (const auto &e : edges) {
+    queue.push(calc_edge_collapse(mesh, e[0], e[1]));
+  }
+  Collapse_Scratch scratch;
+  size_t num_removed = 0;
+  while (num_removed < max_removed && !queue.empty()) {
+    auto c = queue.top();
+    queue.pop();
+    if (c.version0 != mesh.versions[c.v0] ||
+        c.version1 != mesh.versions[c.v1]) {
+      continue;
+    }
+    int removed = try_edge_collapse(mesh, c, scratch);
+    if (removed == 0) {
+      continue;
+    }
+    num_removed += size_t(removed);
+    scratch.neighbours0.clear();
+    for (auto t : mesh.vertex_tris[c.v0]) {
+      for (auto v : mesh.tris[t]) {
+        scratch.neighbours0.push_back(v);
+      }
+    }
+    std::sort(scratch.neighbours0.begin(), scratch.neighbours0.end());
+    scratch.neighbours0.erase(
+        std::unique(scratch.neighbours0.begin(), scratch.neighbours0.end()),
+        scratch.neighbours0.end());
+    for (auto v : scratch.neighbours0) {
+      if (v != c.v0 && mesh.vertex_patches[v] == patch) {
+        queue.push(calc_edge_collapse(mesh, c.v0, v));
+      }
+    }
+  }
+  return num_removed;
+}
+
+// Spreads the lowest 10 bits of v to every third bit
+inline uint32_t spread_bits_3d(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// Assigns triangles to num_patches patches of consecutive triangles along
+// the Morton curve of their centroids, and vertices to the patch of their
+// triangles or locked_patch if those differ.
+template <typename T>
+void partition_decimation_mesh(Decimation_Mesh<T> &mesh, size_t num_patches) {
+  const size_t num_tris = mesh.tris.size();
+  const auto &p = mesh.vertices;
+  Vec3<T> lo = p[0], hi = p[0];
+  for (const auto &v : p) {
+    lo = lo.min(v);
+    hi = hi.max(v);
+  }
+  auto extent = hi - lo;
+  T scale = T(1023) / std::max({extent.x, extent.y, extent.z, T(1e-30)});
+  std::vector<uint32_t> codes(num_tris);
+  parallel_for(num_tris, [&](size_t i) {
+    const auto &t = mesh.tris[i];
+    auto c = ((p[t[0]] + p[t[1]] + p[t[2]]) / T(3) - lo) * scale;
+    codes[i] = spread_bits_3d(uint32_t(c.x)) |
+               spread_bits_3d(uint32_t(c.y)) << 1 |
+               spread_bits_3d(uint32_t(c.z)) << 2;
+  });
+  std::vector<uint32_t> order(num_tris);
+  parallel_for(num_tris, [&](size_t i) { order[i] = uint32_t(i); });
+  radix_sort(order, [&](uint32_t t) { return codes[t]; });
+
+  // Vertices without triangles keep a patch past the last one
+  const auto no_patch = uint32_t(num_patches);
+  std::vector<std::atomic<uint32_t>> vertex_patches(p.size());
+  parallel_for(p.size(), [&](size_t i) {
+    vertex_patches[i].store(no_patch, std::memory_order_relaxed);
+  });
+  parallel_for(num_tris, [&](size_t rank) {
+    auto patch = uint32_t(rank * num_patches / num_tris);
+    for (auto v : mesh.tris[order[rank]]) {
+      uint32_t current = no_patch;
+      if (!vertex_patches[v].compare_exchange_strong(
+              current, patch, std::memory_order_relaxed) &&
+          current != patch) {
+        vertex_patches[v].store(locked_patch, std::memory_order_relaxed);
+      }
+    }
+  });
+  parallel_for(p.size(), [&](size_t i) {
+    mesh.vertex_patches[i] = vertex_patches[i].load(std::memory_order_relaxed);
+  });
+}
+
+// Live triangles and the vertices they use, renumbered in order
+template <typename T>
+Indexed_Tri_Mesh<T> compact_decimation_mesh(const Decimation_Mesh<T> &mesh) {
+  constexpr uint32_t no_vertex = std::numeric_limits<uint32_t>::max();
+  Indexed_Tri_Mesh<T> out;
+  std::vector<uint32_t> new_indices(mesh.vertices.size(), no_vertex);
+  for (size_t i = 0; i < mesh.tris.size(); i++) {
+    if (mesh.is_removed_tri[i]) {
+      continue;
+    }
+    std::array<uint32_t, 3> tri;
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = mesh.tris[i][k];
+      if (new_indices[v] == no_vertex) {
+        new_indices[v] = uint32_t(out.vertices.size());
+        out.vertices.push_back(mesh.vertices[v]);
+      }
+      tri[k] = new_indices[v];
+    }
+    out.tris.push_back(tri);
+  }
+  return out;
+}
+
+// Quadric error edge collapse decimation down to target_num_tris triangles.
+// With several patches the triangles are first split into patches of
+// neighbouring triangles that are decimated in parallel, each to its share
+// of the target, while the vertices on patch boundaries stay locked. A
+// serial pass over the whole mesh then reaches the target and decimates the
+// patch boundaries. The result depends on the number of patches but not on
+// the number of threads.
+template <typename T>
+Indexed_Tri_Mesh<T> decimate_mesh(const Indexed_Tri_Mesh<T> &mesh,
+                                  size_t target_num_tris,
+                                  size_t num_patches = 1) {
+  const size_t num_tris = mesh.tris.size();
+  if (num_tris <= target_num_tris) {
+    return mesh;
+  }
+  auto dmesh = make_decimation_mesh(mesh);
+  size_t num_removed = 0;
+  if (num_patches > 1) {
+    partition_decimation_mesh(dmesh, num_patches);
+    // Edges between patches or with a locked vertex are left out of every
+    // patch, group_by_label drops those labelled no_island
+    std::vector<uint32_t> edge_patches(dmesh.edges.size());
+    parallel_for(dmesh.edges.size(), [&](size_t i) {
+      const auto &e = dmesh.edges[i];
+      uint32_t patch = dmesh.vertex_patches[e.a];
+      bool is_patch_edge =
+          patch != locked_patch && patch == dmesh.vertex_patches[e.b];
+      edge_patches[i] = is_patch_edge ? patch : no_island;
+    });
+    auto patch_edges = group_by_label(edge_patches, num_patches);
+    // A triangle with two corners in a patch has one of its edges and can be
+    // removed by its collapses, so it counts towards the patch's share. The
+    // others are left to the serial pass.
+    std::vector<size_t> patch_num_tris(num_patches, 0);
+    for (const auto &t : dmesh.tris) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t patch = dmesh.vertex_patches[t[k]];
+        if (patch < num_patches &&
+            patch == dmesh.vertex_patches[t[(k + 1) % 3]]) {
+          patch_num_tris[patch]++;
+          break;
+        }
+      }
+    }
+
+    std::vector<size_t> patch_removed(num_patches, 0);
+    parallel_for(
+        num_patches,
+        [&](size_t patch) {
+          auto edge_indices = patch_edges[patch];
+          std::vector<std::array<uint32_t, 2>> edges;
+          edges.reserve(edge_indices.size());
+          for (auto e : edge_indices) {
+            edges.push_back({dmesh.edges[e].a, dmesh.edges[e].b});
+          }
+          size_t size = patch_num_tris[patch];
+          size_t patch_target =
+              (target_num_tris * size + num_tris - 1) / num_tris;
+          // One short, as a collapse can remove two triangles
+          size_t max_removed = size - std::min(size, patch_target + 1);
+          patch_removed[patch] =
+              decimate_patch(dmesh, edges, uint32_t(patch), max_removed);
+        },
+        1);
+    for (auto removed : patch_removed) {
+      num_removed += removed;
+    }
+  }
+
+  // Edges of the live triangles, every edge once
+  std::vector<uint64_t> edge_keys;
+  for (size_t i = 0; i < num_tris; i++) {
+    if (dmesh.is_removed_tri[i]) {
+      continue;
+    }
+    const auto &t = dmesh.tris[i];
+    for (int k = 0; k < 3; k++) {
+      uint32_t a = t[k], b = t[(k + 1) % 3];
+      edge_keys.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+    }
+  }
+  radix_sort(edge_keys, [](uint64_t key) { return key; });
+  edge_keys.erase(std::unique(edge_keys.begin(), edge_keys.end()),
+                  edge_keys.end());
+  std::vector<std::array<uint32_t, 2>> edges(edge_keys.size());
+  parallel_for(edge_keys.size(), [&](size_t i) {
+    edges[i] = {uint32_t(edge_keys[i] >> 32), uint32_t(edge_keys[i])};
+  });
+  std::fill(dmesh.vertex_patches.begin(), dmesh.vertex_patches.end(), 0);
+  if (num_tris - num_removed > target_num_tris) {
+    decimate_patch(dmesh, edges, 0,
+                   num_tris - num_removed - target_num_tris);
+  }
+  return compact_decimation_mesh(dmesh);
+}
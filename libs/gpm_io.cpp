@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+#include "gpm_io.hpp"
+#include "parallel.hpp"
+
+static size_t align_up(size_t offset) {
+  return (offset + gpm_alignment - 1) / gpm_alignment * gpm_alignment;
+}
+
+static uint64_t block_count(const Gpm_Block &block, const Gpm_Header &header) {
+  return block.domain == Gpm_Domain::Vertex ? header.num_vertices
+                                            : header.num_tris;
+}
+
+static bool is_valid_block(const Gpm_Block &block, const Gpm_Header &header,
+                           size_t file_size) {
+  size_t type_size = gpm_type_size(block.type);
+  if (type_size == 0 || block.offset % gpm_alignment != 0 ||
+      block.offset > file_size || block.size > file_size - block.offset ||
+      std::memchr(block.name, '\0', sizeof(block.name)) == nullptr ||
+      (block.domain != Gpm_Domain::Vertex &&
+       block.domain != Gpm_Domain::Tri)) {
+    return false;
+  }
+  // Row counts come from the header, so the decoded size is bounded by the
+  // stored data before anything is allocated for it
+  const uint64_t num_rows = block_count(block, header);
+  const uint64_t row_size = uint64_t(block.components) * type_size;
+  if (row_size != 0 && num_rows > UINT64_MAX / row_size) {
+    return false;
+  }
+  if (block.encoding == Gpm_Encoding::Raw) {
+    return block.size == num_rows * row_size;
+  }
+  // Every chunk holds at least one width byte per group of values
+  return block.encoding == Gpm_Encoding::Packed && block.size >= 8 &&
+         num_rows * block.components / gpm_group_size <= block.size;
+}
+
+// Triangle indices of neighbouring corners are close, other blocks are best
+// predicted by the same component of the previous row.
+static size_t delta_stride(const Gpm_Block &block) {
+  return block.domain == Gpm_Domain::Tri && block.type == Gpm_Type::U32
+             ? 1
+             : block.components;
+}
+
+static uint64_t load_bits(const char *p, size_t size) {
+  uint64_t bits = 0;
+  std::memcpy(&bits, p, size);
+  return bits;
+}
+
+static uint64_t zigzag(uint64_t delta, unsigned num_bits) {
+  int64_t d = int64_t(delta << (64 - num_bits)) >> (64 - num_bits);
+  return (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+}
+
+static uint64_t unzigzag(uint64_t z) { return (z >> 1) ^ (0 - (z & 1)); }
+
+static size_t group_bytes(size_t num_values, unsigned width) {
+  return (num_values * width + 7) / 8;
+}
+
+static std::vector<char> encode_chunk(const char *data, size_t num_values,
+                                      size_t value_size, size_t stride) {
+  const unsigned num_bits = unsigned(value_size * 8);
+  std::vector<uint64_t> zigzags(num_values);
+  for (size_t i = 0; i < num_values; i++) {
+    uint64_t prev = i >= stride ? load_bits(data + (i - stride) * value_size,
+                                            value_size)
+                                : 0;
+    uint64_t value = load_bits(data + i * value_size, value_size);
+    zigzags[i] = zigzag(value - prev, num_bits);
+  }
+
+  const size_t num_groups = (num_values + gpm_group_size - 1) / gpm_group_size;
+  std::vector<uint8_t> widths(num_groups, 0);
+  size_t size = num_groups + 8;
+  for (size_t g = 0; g < num_groups; g++) {
+    size_t begin = g * gpm_group_size;
+    size_t end = std::min(num_values, begin + gpm_group_size);
+    uint64_t all_bits = 0;
+    for (size_t i = begin; i < end; i++) {
+      all_bits |= zigzags[i];
+    }
+    while (widths[g] < 64 && (all_bits >> widths[g]) != 0) {
+      widths[g]++;
+    }
+    size += group_bytes(end - begin, widths[g]);
+  }
+
+  std::vector<char> out(size, 0);
+  std::memcpy(out.data(), widths.data(), num_groups);
+  char *group = out.data() + num_groups;
+  for (size_t g = 0; g < num_groups; g++) {
+    size_t begin = g * gpm_group_size;
+    size_t end = std::min(num_values, begin + gpm_group_size);
+    const unsigned width = widths[g];
+    for (size_t i = begin; i < end && width > 0; i++) {
+      size_t bit = (i - begin) * width;
+      char *p = group + bit / 8;
+      unsigned shift = bit % 8;
+      uint64_t word = load_bits(p, 8) | (zigzags[i] << shift);
+      std::memcpy(p, &word, 8);
+      if (shift + width > 64) {
+        p[8] = char(uint8_t(p[8]) | uint8_t(zigzags[i] >> (64 - shift)));
+      }
+    }
+    group += group_bytes(end - begin, width);
+  }
+  return out;
+}
+
+// Templated on the value type so values are loaded with a fixed size
+template <typename U>
+static bool decode_chunk(const char *chunk, size_t chunk_size, char *out,
+                         size_t num_values, size_t stride) {
+  constexpr size_t value_size = sizeof(U);
+  constexpr unsigned num_bits = unsigned(value_size * 8);
+  const size_t num_groups = (num_values + gpm_group_size - 1) / gpm_group_size;
+  if (chunk_size < num_groups + 8) {
+    return false;
+  }
+  const uint8_t *widths = reinterpret_cast<const uint8_t *>(chunk);
+  const char *group = chunk + num_groups;
+  const char *groups_end = chunk + chunk_size - 8;
+  for (size_t g = 0; g < num_groups; g++) {
+    size_t begin = g * gpm_group_size;
+    size_t end = std::min(num_values, begin + gpm_group_size);
+    const unsigned width = widths[g];
+    const uint64_t width_mask =
+        width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+    if (width > num_bits ||
+        size_t(groups_end - group) < group_bytes(end - begin, width)) {
+      return false;
+    }
+    for (size_t i = begin; i < end; i++) {
+      uint64_t z = 0;
+      if (width > 0) {
+        size_t bit = (i - begin) * width;
+        const char *p = group + bit / 8;
+        unsigned shift = bit % 8;
+        z = load_bits(p, 8) >> shift;
+        if (shift + width > 64) {
+          z |= uint64_t(uint8_t(p[8])) << (64 - shift);
+        }
+        z &= width_mask;
+      }
+      U prev = 0;
+      if (i >= stride) {
+        std::memcpy(&prev, out + (i - stride) * value_size, value_size);
+      }
+      U value = U(prev + U(unzigzag(z)));
+      std::memcpy(out + i * value_size, &value, value_size);
+    }
+    group += group_bytes(end - begin, width);
+  }
+  return true;
+}
+
+static std::vector<char> encode_block(const char *data, size_t num_rows,
+                                      size_t components, size_t value_size,
+                                      size_t stride) {
+  const size_t num_chunks =
+      (num_rows + gpm_rows_per_chunk - 1) / gpm_rows_per_chunk;
+  std::vector<std::vector<char>> chunks(num_chunks);
+  const size_t row_size = components * value_size;
+  parallel_for(
+      num_chunks,
+      [&](size_t c) {
+        size_t begin = c * gpm_rows_per_chunk;
+        size_t end = std::min(num_rows, begin + gpm_rows_per_chunk);
+        chunks[c] = encode_chunk(data + begin * row_size,
+                                 (end - begin) * components, value_size,
+                                 stride);
+      },
+      1);
+
+  std::vector<uint64_t> chunk_offsets(num_chunks + 1);
+  chunk_offsets[0] = 8 + chunk_offsets.size() * sizeof(uint64_t);
+  for (size_t c = 0; c < num_chunks; c++) {
+    chunk_offsets[c + 1] = chunk_offsets[c] + chunks[c].size();
+  }
+  std::vector<char> out(chunk_offsets.back());
+  uint32_t chunk_header[2] = {gpm_rows_per_chunk, uint32_t(num_chunks)};
+  std::memcpy(out.data(), chunk_header, sizeof(chunk_header));
+  std::memcpy(out.data() + 8, chunk_offsets.data(),
+              chunk_offsets.size() * sizeof(uint64_t));
+  parallel_for(
+      num_chunks,
+      [&](size_t c) {
+        std::memcpy(out.data() + chunk_offsets[c], chunks[c].data(),
+                    chunks[c].size());
+      },
+      1);
+  return out;
+}
+
+bool Gpm_File::open(const char *path) {
+  blocks = nullptr;
+  if (!file.open(path) || file.size < sizeof(Gpm_Header)) {
+    return false;
+  }
+  std::memcpy(&header, file.data, sizeof(Gpm_Header));
+  if (std::memcmp(header.magic, gpm_magic, sizeof(gpm_magic)) != 0 ||
+      header.version == 0 || header.version > gpm_version ||
+      header.num_blocks >
+          (file.size - sizeof(Gpm_Header)) / sizeof(Gpm_Block)) {
+    return false;
+  }
+  blocks = reinterpret_cast<const Gpm_Block *>(file.data + sizeof(Gpm_Header));
+  for (uint32_t i = 0; i < header.num_blocks; i++) {
+    if (!is_valid_block(blocks[i], header, file.size)) {
+      blocks = nullptr;
+      return false;
+    }
+  }
+  const Gpm_Block *vertex_block = find_block("vertices");
+  const Gpm_Block *tri_block = find_block("tris");
+  bool is_valid =
+      vertex_block && vertex_block->domain == Gpm_Domain::Vertex &&
+      vertex_block->components == 3 &&
+      (vertex_block->type == Gpm_Type::F32 ||
+       vertex_block->type == Gpm_Type::F64) &&
+      tri_block && tri_block->domain == Gpm_Domain::Tri &&
+      tri_block->components == 3 && tri_block->type == Gpm_Type::U32;
+  if (!is_valid) {
+    blocks = nullptr;
+  }
+  return is_valid;
+}
+
+const Gpm_Block *Gpm_File::find_block(std::string_view name) const {
+  for (uint32_t i = 0; blocks && i < header.num_blocks; i++) {
+    if (name == blocks[i].name) {
+      return &blocks[i];
+    }
+  }
+  return nullptr;
+}
+
+size_t Gpm_File::decoded_size(const Gpm_Block &block) const {
+  return block_count(block, header) * block.components *
+         gpm_type_size(block.type);
+}
+
+bool Gpm_File::decode(const Gpm_Block &block, void *out) const {
+  const char *data = block_data(block);
+  if (block.encoding == Gpm_Encoding::Raw) {
+    std::memcpy(out, data, block.size);
+    return true;
+  }
+  const size_t num_rows = block_count(block, header);
+  uint32_t chunk_header[2];
+  std::memcpy(chunk_header, data, sizeof(chunk_header));
+  const size_t rows_per_chunk = chunk_header[0];
+  const size_t num_chunks = chunk_header[1];
+  if (rows_per_chunk == 0 ||
+      num_chunks != (num_rows + rows_per_chunk - 1) / rows_per_chunk ||
+      (num_chunks + 1) * sizeof(uint64_t) > block.size - 8) {
+    return false;
+  }
+  std::vector<uint64_t> chunk_offsets(num_chunks + 1);
+  std::memcpy(chunk_offsets.data(), data + 8,
+              chunk_offsets.size() * sizeof(uint64_t));
+  if (chunk_offsets[0] < 8 + chunk_offsets.size() * sizeof(uint64_t) ||
+      chunk_offsets.back() > block.size ||
+      !std::is_sorted(chunk_offsets.begin(), chunk_offsets.end())) {
+    return false;
+  }
+
+  const size_t value_size = gpm_type_size(block.type);
+  const size_t row_size = block.components * value_size;
+  const size_t stride = delta_stride(block);
+  auto decode = value_size == 1   ? decode_chunk<uint8_t>
+                : value_size == 2 ? decode_chunk<uint16_t>
+                : value_size == 4 ? decode_chunk<uint32_t>
+                                  : decode_chunk<uint64_t>;
+  std::atomic<bool> is_valid{true};
+  parallel_for(
+      num_chunks,
+      [&](size_t c) {
+        size_t begin = c * rows_per_chunk;
+        size_t end = std::min(num_rows, begin + rows_per_chunk);
+        if (!decode(data + chunk_offsets[c],
+                    chunk_offsets[c + 1] - chunk_offsets[c],
+                    static_cast<char *>(out) + begin * row_size,
+                    (end - begin) * block.components, stride)) {
+          is_valid = false;
+        }
+      },
+      1);
+  return is_valid;
+}
+
+bool Gpm_File::read(Indexed_Tri_Mesh<double> &mesh) const {
+  const Gpm_Block *vertex_block = find_block("vertices");
+  const Gpm_Block *tri_block = find_block("tris");
+  mesh.vertices.assign(header.num_vertices, Vec3<double>(0, 0, 0));
+  mesh.tris.resize(header.num_tris);
+  if (vertex_block->type == Gpm_Type::F64) {
+    if (!decode(*vertex_block, mesh.vertices.data())) {
+      return false;
+    }
+  } else {
+    std::vector<Vec3<float>> vertices(header.num_vertices,
+                                      Vec3<float>(0, 0, 0));
+    if (!decode(*vertex_block, vertices.data())) {
+      return false;
+    }
+    parallel_for(mesh.vertices.size(), [&](size_t i) {
+      mesh.vertices[i] = vertices[i].as<double>();
+    });
+  }
+  return decode(*tri_block, mesh.tris.data());
+}
+
+void write_gpm(const char *path, const Indexed_Tri_Mesh<double> &mesh,
+               Gpm_Type vertex_type,
+               const std::vector<Gpm_Attribute> &attributes,
+               Gpm_Encoding encoding) {
+  assert(vertex_type == Gpm_Type::F32 || vertex_type == Gpm_Type::F64);
+  std::vector<Vec3<float>> float_vertices;
+  const void *vertex_data = mesh.vertices.data();
+  if (vertex_type == Gpm_Type::F32) {
+    float_vertices.resize(mesh.vertices.size(), Vec3<float>(0, 0, 0));
+    parallel_for(mesh.vertices.size(), [&](size_t i) {
+      float_vertices[i] = mesh.vertices[i].as<float>();
+    });
+    vertex_data = float_vertices.data();
+  }
+
+  std::vector<Gpm_Block> blocks(2 + attributes.size());
+  std::vector<const char *> block_sources(blocks.size());
+  std::vector<std::vector<char>> packed_blocks(blocks.size());
+  auto set_block = [&](size_t i, const std::string &name, Gpm_Domain domain,
+                       Gpm_Type type, uint32_t components, const void *data) {
+    assert(name.size() < sizeof(Gpm_Block::name));
+    Gpm_Block &block = blocks[i];
+    std::memset(&block, 0, sizeof(Gpm_Block));
+    std::memcpy(block.name, name.data(), name.size());
+    block.domain = domain;
+    block.type = type;
+    block.components = components;
+    block.encoding = encoding;
+    size_t count = domain == Gpm_Domain::Vertex ? mesh.vertices.size()
+                                                : mesh.tris.size();
+    block.size = count * components * gpm_type_size(type);
+    block_sources[i] = static_cast<const char *>(data);
+    if (encoding == Gpm_Encoding::Packed) {
+      packed_blocks[i] =
+          encode_block(block_sources[i], count, components,
+                       gpm_type_size(type), delta_stride(block));
+      block.size = packed_blocks[i].size();
+      block_sources[i] = packed_blocks[i].data();
+    }
+  };
+  set_block(0, "vertices", Gpm_Domain::Vertex, vertex_type, 3, vertex_data);
+  set_block(1, "tris", Gpm_Domain::Tri, Gpm_Type::U32, 3, mesh.tris.data());
+  for (size_t i = 0; i < attributes.size(); i++) {
+    const auto &a = attributes[i];
+    set_block(2 + i, a.name, a.domain, a.type, a.components, a.data);
+  }
+  size_t offset =
+      align_up(sizeof(Gpm_Header) + blocks.size() * sizeof(Gpm_Block));
+  for (auto &block : blocks) {
+    block.offset = offset;
+    offset = align_up(offset + block.size);
+  }
+
+  Gpm_Header header = {};
+  std::memcpy(header.magic, gpm_magic, sizeof(gpm_magic));
+  header.version = gpm_version;
+  header.num_blocks = uint32_t(blocks.size());
+  header.num_vertices = mesh.vertices.size();
+  header.num_tris = mesh.tris.size();
+
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char *>(&header), sizeof(Gpm_Header));
+  ofs.write(reinterpret_cast<const char *>(blocks.data()),
+            blocks.size() * sizeof(Gpm_Block));
+  const char padding[gpm_alignment] = {};
+  for (size_t i = 0; i < blocks.size(); i++) {
+    ofs.write(padding, blocks[i].offset - size_t(ofs.tellp()));
+    ofs.write(block_sources[i], blocks[i].size);
+  }
+}
+
+bool read_gpm(const char *path, Indexed_Tri_Mesh<double> &mesh) {
+  Gpm_File file;
+  if (!file.open(path) || !file.read(mesh)) {
+    mesh = Indexed_Tri_Mesh<double>();
+    return false;
+  }
+  for (const auto &t : mesh.tris) {
+    for (auto vi : t) {
+      if (vi >= mesh.vertices.size()) {
+        mesh = Indexed_Tri_Mesh<double>();
+        return false;
+      }
+    }
+  }
+  return true;
+}
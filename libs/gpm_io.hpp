@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "indexed_tri_mesh.hpp"
+#include "mapped_file.hpp"
+#include "vec3.hpp"
+
+// Native little endian indexed mesh format (.gpm). The file starts with a
+// 64 byte header followed by a table of 64 byte block descriptions. Every
+// block starts at a multiple of 64 bytes, so mapped blocks can be used in
+// place. The "vertices" block holds num_vertices float or double triples and
+// the "tris" block holds num_tris uint32 triples, any other block is a per
+// vertex or per triangle attribute.
+//
+// Version 2 adds packed blocks, which are split into chunks of rows that are
+// compressed independently and can be decoded in parallel. A packed block
+// starts with uint32 rows_per_chunk and num_chunks, followed by num_chunks + 1
+// uint64 chunk offsets relative to the block. Within a chunk every value is
+// replaced by the zigzag encoded difference of its bit pattern to the value
+// one delta stride earlier, a row for vertices and attributes and a single
+// value for triangle indices. Values are then bit packed in groups of
+// gpm_group_size, a chunk holds one width byte per group, the packed groups
+// and 8 bytes of padding.
+
+constexpr char gpm_magic[4] = {'G', 'P', 'M', '\0'};
+constexpr uint32_t gpm_version = 2;
+constexpr size_t gpm_alignment = 64;
+constexpr uint32_t gpm_rows_per_chunk = 1 << 15;
+constexpr size_t gpm_group_size = 128;
+
+enum class Gpm_Type : uint32_t {
+  U8 = 0,
+  U16 = 1,
+  U32 = 2,
+  F32 = 3,
+  F64 = 4,
+};
+
+enum class Gpm_Domain : uint32_t {
+  Vertex = 0,
+  Tri = 1,
+};
+
+enum class Gpm_Encoding : uint32_t {
+  Raw = 0,
+  Packed = 1,
+};
+
+inline size_t gpm_type_size(Gpm_Type type) {
+  switch (type) {
+  case Gpm_Type::U8:
+    return 1;
+  case Gpm_Type::U16:
+    return 2;
+  case Gpm_Type::U32:
+  case Gpm_Type::F32:
+    return 4;
+  case Gpm_Type::F64:
+    return 8;
+  }
+  return 0;
+}
+
+struct Gpm_Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_blocks;
+  uint32_t reserved;
+  uint64_t num_vertices;
+  uint64_t num_tris;
+  uint8_t padding[32];
+};
+static_assert(sizeof(Gpm_Header) == 64);
+
+struct Gpm_Block {
+  char name[32];
+  Gpm_Domain domain;
+  Gpm_Type type;
+  uint32_t components;
+  // Always raw in version 1 files
+  Gpm_Encoding encoding;
+  // Both in bytes, offset is from the start of the file. The size is the
+  // stored size, which only matches the decoded size for raw blocks.
+  uint64_t offset;
+  uint64_t size;
+};
+static_assert(sizeof(Gpm_Block) == 64);
+
+// Attribute to write, data holds components values of type for every vertex
+// or triangle of the domain.
+struct Gpm_Attribute {
+  std::string name;
+  Gpm_Domain domain;
+  Gpm_Type type;
+  uint32_t components;
+  const void *data;
+};
+
+// Mesh whose arrays live elsewhere, usually in a mapped file
+template <typename T> struct Indexed_Tri_Mesh_View {
+  const Vec3<T> *vertices = nullptr;
+  size_t num_vertices = 0;
+  const std::array<uint32_t, 3> *tris = nullptr;
+  size_t num_tris = 0;
+};
+
+// Memory mapped .gpm file, blocks are only validated against the file size
+// and packed blocks are validated while decoding.
+struct Gpm_File {
+  Mapped_File file;
+  Gpm_Header header = {};
+  const Gpm_Block *blocks = nullptr;
+
+  // Returns false if the file is missing, truncated or of another version.
+  bool open(const char *path);
+  const Gpm_Block *find_block(std::string_view name) const;
+  const char *block_data(const Gpm_Block &block) const {
+    return file.data + block.offset;
+  }
+  size_t decoded_size(const Gpm_Block &block) const;
+  // Decodes the block into out, which must hold decoded_size(block) bytes.
+  // Chunks of packed blocks are decoded in parallel. Returns false on
+  // corrupt packed data.
+  bool decode(const Gpm_Block &block, void *out) const;
+  // Raw vertices stored as F32 for float and F64 for double can be viewed in
+  // place, returns an empty view if the type or encoding does not match.
+  template <typename T> Indexed_Tri_Mesh_View<T> view() const;
+  // Copies the mesh, converting float vertices to double.
+  bool read(Indexed_Tri_Mesh<double> &mesh) const;
+};
+
+// vertex_type is either Gpm_Type::F32 or Gpm_Type::F64. With packed
+// encoding every block is compressed, the result is lossless for both vertex
+// types.
+void write_gpm(const char *path, const Indexed_Tri_Mesh<double> &mesh,
+               Gpm_Type vertex_type = Gpm_Type::F64,
+               const std::vector<Gpm_Attribute> &attributes = {},
+               Gpm_Encoding encoding = Gpm_Encoding::Raw);
+
+bool read_gpm(const char *path, Indexed_Tri_Mesh<double> &mesh);
+
+template <typename T>
+Indexed_Tri_Mesh_View<T> Gpm_File::view() const {
+  static_assert(sizeof(Vec3<T>) == sizeof(T[3]));
+  constexpr Gpm_Type vertex_type =
+      sizeof(T) == sizeof(float) ? Gpm_Type::F32 : Gpm_Type::F64;
+  const Gpm_Block *vertex_block = find_block("vertices");
+  const Gpm_Block *tri_block = find_block("tris");
+  if (!vertex_block || !tri_block || vertex_block->type != vertex_type ||
+      vertex_block->encoding != Gpm_Encoding::Raw ||
+      tri_block->encoding != Gpm_Encoding::Raw) {
+    return {};
+  }
+  Indexed_Tri_Mesh_View<T> view;
+  view.vertices = reinterpret_cast<const Vec3<T> *>(block_data(*vertex_block));
+  view.num_vertices = header.num_vertices;
+  view.tris = reinterpret_cast<const std::array<uint32_t, 3> *>(
+      block_data(*tri_block));
+  view.num_tris = header.num_tris;
+  return view;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "indexed_tri_mesh.hpp"
+#include "mesh_adjacency.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+
+// Twin of boundary half-edges
+constexpr uint32_t no_half_edge = std::numeric_limits<uint32_t>::max();
+// Twin of half-edges on edges with more than two triangles, inconsistently
+// oriented triangles or triangles with coincident vertices
+constexpr uint32_t non_manifold_half_edge = no_half_edge - 1;
+
+// Triangle mesh with half-edge connectivity, stored as arrays indexed by
+// half-edge. Half-edge 3 * t + k of triangle t goes from corner k to corner
+// k + 1, so the next and previous half-edges and the triangle of a half-edge
+// are implicit and only the origin vertex and the twin are stored.
+template <typename T> struct Half_Edge_Mesh {
+  std::vector<Vec3<T>> vertices;
+  // Origin vertex of every half-edge
+  std::vector<uint32_t> half_edge_vertices;
+  std::vector<uint32_t> twins;
+  // An outgoing half-edge of every vertex, without a twin if there is one so
+  // that rotating from it covers the whole fan, or no_half_edge for unused
+  // vertices
+  std::vector<uint32_t> vertex_half_edges;
+  // Undirected edge of every half-edge and the first half-edge of every edge,
+  // which also holds for non-manifold edges with more than two half-edges
+  std::vector<uint32_t> half_edge_edges;
+  std::vector<uint32_t> edges;
+
+  static uint32_t next(uint32_t h) { return h % 3 == 2 ? h - 2 : h + 1; }
+  static uint32_t prev(uint32_t h) { return h % 3 == 0 ? h + 2 : h - 1; }
+  static uint32_t face(uint32_t h) { return h / 3; }
+
+  size_t num_faces() const { return half_edge_vertices.size() / 3; }
+  size_t num_edges() const { return edges.size(); }
+  uint32_t origin(uint32_t h) const { return half_edge_vertices[h]; }
+  uint32_t target(uint32_t h) const { return half_edge_vertices[next(h)]; }
+  bool has_twin(uint32_t h) const { return twins[h] < non_manifold_half_edge; }
+  bool is_boundary_edge(uint32_t h) const { return twins[h] == no_half_edge; }
+  bool is_manifold_edge(uint32_t h) const {
+    return twins[h] != non_manifold_half_edge;
+  }
+  bool is_boundary_vertex(uint32_t v) const {
+    return vertex_half_edges[v] != no_half_edge &&
+           !has_twin(vertex_half_edges[v]);
+  }
+
+  // Calls f(h) for the outgoing half-edges of v in rotation order, starting
+  // from vertex_half_edges[v]. Every step costs O(1), rotation stops at
+  // boundary and non-manifold edges.
+  template <typename F> void for_each_outgoing(uint32_t v, F &&f) const {
+    uint32_t first = vertex_half_edges[v];
+    if (first == no_half_edge) {
+      return;
+    }
+    uint32_t h = first;
+    do {
+      f(h);
+      uint32_t incoming = prev(h);
+      if (!has_twin(incoming)) {
+        return;
+      }
+      h = twins[incoming];
+    } while (h != first);
+  }
+
+  // Calls f(vi) for the vertices of the one-ring of v, including the last
+  // vertex of a boundary fan.
+  template <typename F> void for_each_neighbour(uint32_t v, F &&f) const {
+    uint32_t last = no_half_edge;
+    for_each_outgoing(v, [&](uint32_t h) {
+      f(target(h));
+      last = h;
+    });
+    if (last != no_half_edge && !has_twin(prev(last))) {
+      f(origin(prev(last)));
+    }
+  }
+
+  // Twins pair up the two half-edges of edges with exactly one half-edge in
+  // each direction, the half-edges of every edge are grouped with a radix
+  // sort so the build does not depend on the order of the triangles.
+  static Half_Edge_Mesh<T> from_indexed_mesh(const Indexed_Tri_Mesh<T> &mesh) {
+    Half_Edge_Mesh<T> out;
+    const size_t num_vertices = mesh.vertices.size();
+    const size_t num_half_edges = mesh.tris.size() * 3;
+    out.vertices = mesh.vertices;
+    out.half_edge_vertices.resize(num_half_edges);
+    parallel_for(mesh.tris.size(), [&](size_t i) {
+      for (int k = 0; k < 3; k++) {
+        out.half_edge_vertices[i * 3 + k] = mesh.tris[i][k];
+      }
+    });
+
+    auto edge_half_edges =
+        build_edge_half_edge_adjacency(mesh.tris, num_vertices);
+    out.twins.resize(num_half_edges);
+    out.half_edge_edges.resize(num_half_edges);
+    out.edges.resize(edge_half_edges.size());
+    parallel_for(edge_half_edges.size(), [&](size_t i) {
+      auto half_edges = edge_half_edges[i];
+      const uint32_t *h = half_edges.begin();
+      out.edges[i] = h[0];
+      for (auto he : half_edges) {
+        out.half_edge_edges[he] = uint32_t(i);
+      }
+      bool is_degenerate = out.origin(h[0]) == out.target(h[0]);
+      if (half_edges.size() == 1 && !is_degenerate) {
+        out.twins[h[0]] = no_half_edge;
+      } else if (half_edges.size() == 2 && !is_degenerate &&
+                 out.origin(h[0]) == out.target(h[1]) &&
+                 face(h[0]) != face(h[1])) {
+        out.twins[h[0]] = h[1];
+        out.twins[h[1]] = h[0];
+      } else {
+        for (auto he : half_edges) {
+          out.twins[he] = non_manifold_half_edge;
+        }
+      }
+    });
+
+    // The smallest outgoing half-edge without a twin, or else the smallest
+    // outgoing half-edge
+    std::vector<std::atomic<uint32_t>> firsts(num_vertices);
+    std::vector<std::atomic<uint32_t>> first_borders(num_vertices);
+    parallel_for(num_vertices, [&](size_t i) {
+      firsts[i].store(no_half_edge, std::memory_order_relaxed);
+      first_borders[i].store(no_half_edge, std::memory_order_relaxed);
+    });
+    auto store_min = [](std::atomic<uint32_t> &target, uint32_t value) {
+      uint32_t current = target.load(std::memory_order_relaxed);
+      while (value < current &&
+             !target.compare_exchange_weak(current, value,
+                                           std::memory_order_relaxed)) {
+      }
+    };
+    parallel_for(num_half_edges, [&](size_t i) {
+      uint32_t v = out.half_edge_vertices[i];
+      store_min(firsts[v], uint32_t(i));
+      if (!out.has_twin(uint32_t(i))) {
+        store_min(first_borders[v], uint32_t(i));
+      }
+    });
+    out.vertex_half_edges.resize(num_vertices);
+    parallel_for(num_vertices, [&](size_t i) {
+      uint32_t border = first_borders[i].load(std::memory_order_relaxed);
+      out.vertex_half_edges[i] =
+          border != no_half_edge ? border
+                                 : firsts[i].load(std::memory_order_relaxed);
+    });
+    return out;
+  }
+
+  Indexed_Tri_Mesh<T> to_indexed_mesh() const {
+    Indexed_Tri_Mesh<T> mesh;
+    mesh.vertices = vertices;
+    mesh.tris.resize(num_faces());
+    parallel_for(num_faces(), [&](size_t i) {
+      for (int k = 0; k < 3; k++) {
+        mesh.tris[i][k] = half_edge_vertices[i * 3 + k];
+      }
+    });
+    return mesh;
+  }
+
+  // Vertices whose triangles do not form a single fan, found by comparing the
+  // number of outgoing half-edges with the length of the rotation.
+  std::vector<uint32_t> find_non_manifold_vertices() const {
+    const size_t num_vertices = vertex_half_edges.size();
+    std::vector<std::atomic<uint32_t>> valences(num_vertices);
+    parallel_for(num_vertices, [&](size_t i) { valences[i] = 0; });
+    parallel_for(half_edge_vertices.size(), [&](size_t i) {
+      valences[half_edge_vertices[i]].fetch_add(1, std::memory_order_relaxed);
+    });
+    std::vector<uint8_t> is_non_manifold(num_vertices, 0);
+    parallel_for(num_vertices, [&](size_t i) {
+      uint32_t num_rotated = 0;
+      for_each_outgoing(uint32_t(i), [&](uint32_t) { num_rotated++; });
+      is_non_manifold[i] = num_rotated != valences[i];
+    });
+    std::vector<uint32_t> non_manifold_vertices;
+    for (size_t i = 0; i < num_vertices; i++) {
+      if (is_non_manifold[i]) {
+        non_manifold_vertices.push_back(uint32_t(i));
+      }
+    }
+    return non_manifold_vertices;
+  }
+
+  bool is_manifold() const {
+    for (auto twin : twins) {
+      if (twin == non_manifold_half_edge) {
+        return false;
+      }
+    }
+    return find_non_manifold_vertices().empty();
+  }
+};
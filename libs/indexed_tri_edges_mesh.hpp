@@ -2,9 +2,13 @@
 
 #include <array>
 #include <cstdint>
+#include <functional>
+#include <utility>
 #include <vector>
 
 #include "indexed_tri_mesh.hpp"
+#include "mesh_adjacency.hpp"
+#include "parallel.hpp"
 
 union Undirected_Edge {
   uint64_t combined;
@@ -37,33 +41,24 @@ template <typename T> struct Indexed_Tri_Edges_Mesh {
   std::vector<Undirected_Edge> edges;
   std::vector<std::array<uint32_t, 3>> tris;
 
+  // Edges are numbered in the order they first appear in the triangles.
   static Indexed_Tri_Edges_Mesh<T>
   from_indexed_mesh(const Indexed_Tri_Mesh<T> &mesh) {
-    std::vector<Undirected_Edge> edges;
-    edges.reserve(mesh.tris.size() * 3);
-    std::unordered_map<Undirected_Edge, uint32_t> edge_to_index;
-    edge_to_index.reserve(mesh.tris.size() * 3);
-
-    std::vector<std::array<uint32_t, 3>> triangles_of_edges;
-    triangles_of_edges.reserve(mesh.tris.size());
-
-    for (const auto &t : mesh.tris) {
-      std::array<uint32_t, 3> triangle_of_edges;
-      for (int i = 0; i < 3; i++) {
-        auto e = Undirected_Edge(t[i], t[(i + 1) % 3]);
-        auto it = edge_to_index.find(e);
-        if (it == edge_to_index.end()) {
-          auto unique_edge_index = edges.size();
-          edge_to_index[e] = unique_edge_index;
-          triangle_of_edges[i] = unique_edge_index;
-          edges.push_back(e);
-        } else {
-          triangle_of_edges[i] = it->second;
-        }
+    auto edge_half_edges =
+        build_edge_half_edge_adjacency(mesh.tris, mesh.vertices.size());
+    std::vector<Undirected_Edge> edges(edge_half_edges.size(),
+                                       Undirected_Edge(0, 0));
+    std::vector<std::array<uint32_t, 3>> triangles_of_edges(mesh.tris.size());
+    parallel_for(edge_half_edges.size(), [&](size_t i) {
+      auto half_edges = edge_half_edges[i];
+      uint32_t first = *half_edges.begin();
+      const auto &t = mesh.tris[first / 3];
+      edges[i] = Undirected_Edge(t[first % 3], t[(first + 1) % 3]);
+      for (auto h : half_edges) {
+        triangles_of_edges[h / 3][h % 3] = uint32_t(i);
       }
-      triangles_of_edges.push_back(triangle_of_edges);
-    }
-
-    return Indexed_Tri_Edges_Mesh<T>{mesh.vertices, edges, triangles_of_edges};
+    });
+    return Indexed_Tri_Edges_Mesh<T>{mesh.vertices, std::move(edges),
+                                     std::move(triangles_of_edges)};
   }
 };
\ No newline at end of file
@@ -1,13 +1,24 @@
 #pragma once
 
 #include <array>
+#include <cmath>
 #include <cstdint>
 #include <unordered_map>
 #include <vector>
 
+#include "mesh_adjacency.hpp"
+#include "parallel.hpp"
 #include "triangle.hpp"
 #include "vec3.hpp"
 
+enum class Normal_Weighting {
+  // Every adjacent face counts the same
+  Uniform,
+  Area,
+  // Faces are weighted by their angle at the vertex
+  Angle,
+};
+
 template <typename T> struct Indexed_Tri_Mesh {
   std::vector<Vec3<T>> vertices;
   std::vector<std::array<uint32_t, 3>> tris;
@@ -50,22 +61,97 @@ template <typename T> struct Indexed_Tri_Mesh {
     return tris_out;
   }
 
+  // Every vertex sums the normals of its faces in face order, so results do
+  // not depend on the number of threads. With a single thread the normals are
+  // scattered to the vertices, otherwise they are gathered per vertex through
+  // the vertex to corner adjacency.
+  std::vector<Vec3<T>> calc_vertex_normals(
+      Normal_Weighting weighting = Normal_Weighting::Uniform) const {
+    switch (weighting) {
+    case Normal_Weighting::Area:
+      return calc_vertex_normals<Normal_Weighting::Area>();
+    case Normal_Weighting::Angle:
+      return calc_vertex_normals<Normal_Weighting::Angle>();
+    default:
+      return calc_vertex_normals<Normal_Weighting::Uniform>();
+    }
+  }
+
+private:
+  template <Normal_Weighting weighting>
   std::vector<Vec3<T>> calc_vertex_normals() const {
-    std::vector<Vec3<T>> vertex_normals;
-    vertex_normals.resize(vertices.size(), Vec3<T>(0, 0, 0));
-    for (const auto &indexed_tri : tris) {
-      auto v1 = vertices[indexed_tri[0]];
-      auto v2 = vertices[indexed_tri[1]];
-      auto v3 = vertices[indexed_tri[2]];
-      const auto &tri = Triangle<T>{v1, v2, v3};
-      const auto &n = tri.calc_normal();
-      for (int i = 0; i < 3; i++) {
-        vertex_normals[indexed_tri[i]] += n;
+    constexpr bool is_angle_weighted = weighting == Normal_Weighting::Angle;
+    const size_t num_vertices = vertices.size();
+    const size_t num_tris = tris.size();
+    auto calc_face_normal = [](const Triangle<T> &tri) {
+      if constexpr (weighting == Normal_Weighting::Area) {
+        return tri.calc_normal_unnormalized();
+      } else {
+        return tri.calc_normal();
       }
+    };
+    auto calc_corner_angle = [](const Triangle<T> &tri, int k) {
+      auto e1 = tri[(k + 1) % 3] - tri[k];
+      auto e2 = tri[(k + 2) % 3] - tri[k];
+      return std::atan2(e1.cross(e2).length(), e1.dot(e2));
+    };
+
+    std::vector<Vec3<T>> vertex_normals(num_vertices, Vec3<T>(0, 0, 0));
+    if (get_num_threads() == 1 || in_parallel_region) {
+      for (const auto &t : tris) {
+        auto tri = Triangle<T>{vertices[t[0]], vertices[t[1]], vertices[t[2]]};
+        auto n = calc_face_normal(tri);
+        for (int k = 0; k < 3; k++) {
+          if constexpr (is_angle_weighted) {
+            vertex_normals[t[k]] += n * calc_corner_angle(tri, k);
+          } else {
+            vertex_normals[t[k]] += n;
+          }
+        }
+      }
+    } else {
+      std::vector<Vec3<T>> face_normals(num_tris, Vec3<T>(0, 0, 0));
+      std::vector<T> corner_angles(is_angle_weighted ? num_tris * 3 : 0);
+      parallel_for(num_tris, [&](size_t i) {
+        const auto &t = tris[i];
+        auto tri = Triangle<T>{vertices[t[0]], vertices[t[1]], vertices[t[2]]};
+        face_normals[i] = calc_face_normal(tri);
+        if constexpr (is_angle_weighted) {
+          for (int k = 0; k < 3; k++) {
+            corner_angles[i * 3 + k] = calc_corner_angle(tri, k);
+          }
+        }
+      });
+
+      auto vertex_corners = build_vertex_corner_adjacency(tris, num_vertices);
+      parallel_for(num_vertices, [&](size_t i) {
+        Vec3<T> n(0, 0, 0);
+        for (auto corner : vertex_corners[i]) {
+          if constexpr (is_angle_weighted) {
+            n += face_normals[corner / 3] * corner_angles[corner];
+          } else {
+            n += face_normals[corner / 3];
+          }
+        }
+        vertex_normals[i] = n;
+      });
     }
-    for (auto &n : vertex_normals) {
-      n = n.normalized();
-    }
+
+    // Branch free over the flat coordinate array, so it can be vectorized
+    static_assert(sizeof(Vec3<T>) == sizeof(T[3]));
+    T *coords = reinterpret_cast<T *>(vertex_normals.data());
+    parallel_for_blocks(
+        num_vertices, 4096, [&](size_t, size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            T x = coords[i * 3], y = coords[i * 3 + 1], z = coords[i * 3 + 2];
+            T length = std::sqrt(x * x + y * y + z * z);
+            // Zero vectors stay zero
+            T divisor = length > 0 ? length : 1;
+            coords[i * 3] = x / divisor;
+            coords[i * 3 + 1] = y / divisor;
+            coords[i * 3 + 2] = z / divisor;
+          }
+        });
     return vertex_normals;
   }
 };
\ No newline at end of file
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+struct Mapped_File {
+  const char *data = nullptr;
+  size_t size = 0;
+  bool is_open = false;
+
+  Mapped_File() = default;
+  explicit Mapped_File(const char *path) { open(path); }
+  ~Mapped_File() { close(); }
+  Mapped_File(const Mapped_File &) = delete;
+  Mapped_File &operator=(const Mapped_File &) = delete;
+  Mapped_File(Mapped_File &&other) noexcept { *this = std::move(other); }
+  Mapped_File &operator=(Mapped_File &&other) noexcept {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(is_open, other.is_open);
+#ifdef _WIN32
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+#endif
+    return *this;
+  }
+
+#ifdef _WIN32
+  bool open(const char *path) {
+    close();
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+      close();
+      return false;
+    }
+    size = size_t(file_size.QuadPart);
+    is_open = true;
+    if (size == 0) {
+      return true;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+      close();
+      return false;
+    }
+    data = static_cast<const char *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (data) {
+      UnmapViewOfFile(data);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+    data = nullptr;
+    size = 0;
+    is_open = false;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+  }
+
+private:
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#else
+  bool open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size = size_t(st.st_size);
+    if (size > 0) {
+      void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        ::close(fd);
+        size = 0;
+        return false;
+      }
+      data = static_cast<const char *>(ptr);
+    }
+    // The mapping stays valid after closing the descriptor
+    ::close(fd);
+    is_open = true;
+    return true;
+  }
+
+  void close() {
+    if (data) {
+      munmap(const_cast<char *>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    is_open = false;
+  }
+#endif
+};
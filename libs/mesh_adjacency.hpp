@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+
+// Compressed sparse row relation, the neighbours of element i are
+// indices[offsets[i]] to indices[offsets[i + 1] - 1].
+struct Csr_Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> indices;
+
+  struct Range {
+    const uint32_t *first;
+    const uint32_t *last;
+    const uint32_t *begin() const { return first; }
+    const uint32_t *end() const { return last; }
+    size_t size() const { return last - first; }
+  };
+
+  size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  Range operator[](size_t i) const {
+    return {indices.data() + offsets[i], indices.data() + offsets[i + 1]};
+  }
+};
+
+using Tri_List = std::vector<std::array<uint32_t, 3>>;
+
+// Corners of every vertex in ascending order, corner k of triangle t is
+// 3 * t + k. Built with a parallel counting sort: corners are counted and
+// placed with atomic counters and every vertex's corners are sorted
+// afterwards, so the result does not depend on the number of threads.
+inline Csr_Adjacency build_vertex_corner_adjacency(const Tri_List &tris,
+                                                   size_t num_vertices) {
+  Csr_Adjacency adjacency;
+  adjacency.offsets.resize(num_vertices + 1);
+  std::vector<std::atomic<uint32_t>> counters(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) { counters[i] = 0; });
+  parallel_for(tris.size(), [&](size_t i) {
+    for (auto vi : tris[i]) {
+      counters[vi].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  parallel_for(num_vertices,
+               [&](size_t i) { adjacency.offsets[i] = counters[i]; });
+  adjacency.offsets[num_vertices] =
+      parallel_exclusive_scan(adjacency.offsets.data(), num_vertices);
+  parallel_for(num_vertices,
+               [&](size_t i) { counters[i] = adjacency.offsets[i]; });
+
+  adjacency.indices.resize(adjacency.offsets[num_vertices]);
+  parallel_for(tris.size(), [&](size_t i) {
+    for (int k = 0; k < 3; k++) {
+      uint32_t slot =
+          counters[tris[i][k]].fetch_add(1, std::memory_order_relaxed);
+      adjacency.indices[slot] = uint32_t(i * 3 + k);
+    }
+  });
+  parallel_for(num_vertices, [&](size_t i) {
+    std::sort(adjacency.indices.begin() + adjacency.offsets[i],
+              adjacency.indices.begin() + adjacency.offsets[i + 1]);
+  });
+  return adjacency;
+}
+
+// Triangles of every vertex in ascending order, a degenerate triangle is
+// listed once per corner at the vertex.
+inline Csr_Adjacency build_vertex_face_adjacency(const Tri_List &tris,
+                                                 size_t num_vertices) {
+  auto adjacency = build_vertex_corner_adjacency(tris, num_vertices);
+  parallel_for(adjacency.indices.size(),
+               [&](size_t i) { adjacency.indices[i] /= 3; });
+  return adjacency;
+}
+
+// Distinct vertices sharing a triangle with every vertex, in ascending order.
+inline Csr_Adjacency build_vertex_vertex_adjacency(const Tri_List &tris,
+                                                   size_t num_vertices) {
+  auto corners = build_vertex_corner_adjacency(tris, num_vertices);
+  // Every corner adds at most two neighbours, so they are first collected in
+  // twice the space of the corners and compacted once counts are known.
+  std::vector<uint32_t> candidates(corners.indices.size() * 2);
+  Csr_Adjacency adjacency;
+  adjacency.offsets.resize(num_vertices + 1);
+  parallel_for(num_vertices, [&](size_t i) {
+    uint32_t *first = candidates.data() + corners.offsets[i] * 2;
+    uint32_t *last = first;
+    for (auto corner : corners[i]) {
+      const auto &t = tris[corner / 3];
+      for (int k = 1; k < 3; k++) {
+        uint32_t vi = t[(corner % 3 + k) % 3];
+        if (vi != i) {
+          *last++ = vi;
+        }
+      }
+    }
+    std::sort(first, last);
+    adjacency.offsets[i] = uint32_t(std::unique(first, last) - first);
+  });
+  adjacency.offsets[num_vertices] =
+      parallel_exclusive_scan(adjacency.offsets.data(), num_vertices);
+  adjacency.indices.resize(adjacency.offsets[num_vertices]);
+  parallel_for(num_vertices, [&](size_t i) {
+    const uint32_t *first = candidates.data() + corners.offsets[i] * 2;
+    std::copy(first, first + (adjacency.offsets[i + 1] - adjacency.offsets[i]),
+              adjacency.indices.begin() + adjacency.offsets[i]);
+  });
+  return adjacency;
+}
+
+// Distinct triangles sharing an edge with every triangle, in ascending
+// order. Non-manifold edges add every other triangle on the edge.
+inline Csr_Adjacency build_face_face_adjacency(const Tri_List &tris,
+                                               size_t num_vertices) {
+  auto vertex_faces = build_vertex_face_adjacency(tris, num_vertices);
+  // Triangles on the edge from t[k] to t[k + 1] other than ti, found by
+  // intersecting the sorted triangle lists of both vertices.
+  auto for_each_neighbour = [&](size_t ti, auto &&f) {
+    const auto &t = tris[ti];
+    for (int k = 0; k < 3; k++) {
+      auto a = vertex_faces[t[k]];
+      auto b = vertex_faces[t[(k + 1) % 3]];
+      const uint32_t *pa = a.begin(), *pb = b.begin();
+      while (pa != a.end() && pb != b.end()) {
+        if (*pa < *pb) {
+          pa++;
+        } else if (*pb < *pa) {
+          pb++;
+        } else {
+          if (*pa != ti) {
+            f(*pa);
+          }
+          pa++;
+          pb++;
+        }
+      }
+    }
+  };
+
+  Csr_Adjacency adjacency;
+  adjacency.offsets.resize(tris.size() + 1);
+  parallel_for(tris.size(), [&](size_t i) {
+    uint32_t count = 0;
+    for_each_neighbour(i, [&](uint32_t) { count++; });
+    adjacency.offsets[i] = count;
+  });
+  adjacency.offsets[tris.size()] =
+      parallel_exclusive_scan(adjacency.offsets.data(), tris.size());
+  adjacency.indices.resize(adjacency.offsets[tris.size()]);
+  std::vector<uint32_t> num_unique(tris.size());
+  parallel_for(tris.size(), [&](size_t i) {
+    auto first = adjacency.indices.begin() + adjacency.offsets[i];
+    auto last = first;
+    for_each_neighbour(i, [&](uint32_t ti) { *last++ = ti; });
+    std::sort(first, last);
+    num_unique[i] = uint32_t(std::unique(first, last) - first);
+  });
+
+  // Triangles sharing more than one edge are only listed once
+  Csr_Adjacency compacted;
+  compacted.offsets.resize(tris.size() + 1);
+  parallel_for(tris.size(),
+               [&](size_t i) { compacted.offsets[i] = num_unique[i]; });
+  compacted.offsets[tris.size()] =
+      parallel_exclusive_scan(compacted.offsets.data(), tris.size());
+  if (compacted.offsets[tris.size()] == adjacency.indices.size()) {
+    return adjacency;
+  }
+  compacted.indices.resize(compacted.offsets[tris.size()]);
+  parallel_for(tris.size(), [&](size_t i) {
+    auto first = adjacency.indices.begin() + adjacency.offsets[i];
+    std::copy(first, first + num_unique[i],
+              compacted.indices.begin() + compacted.offsets[i]);
+  });
+  return compacted;
+}
+
+// Half-edges keyed by their undirected edge, either packed with the key into
+// one word or stored next to it when they do not fit.
+struct Packed_Half_Edge_Keys {
+  int index_bits;
+  using Item = uint64_t;
+  Item make(uint64_t key, uint32_t index) const {
+    return key << index_bits | index;
+  }
+  uint64_t key(Item h) const { return h >> index_bits; }
+  uint32_t index(Item h) const {
+    return uint32_t(h & ((uint64_t(1) << index_bits) - 1));
+  }
+};
+struct Wide_Half_Edge_Keys {
+  struct Item {
+    uint64_t key;
+    uint32_t index;
+  };
+  Item make(uint64_t key, uint32_t index) const { return {key, index}; }
+  uint64_t key(const Item &h) const { return h.key; }
+  uint32_t index(const Item &h) const { return h.index; }
+};
+
+template <typename Half_Edge_Keys>
+Csr_Adjacency build_edge_half_edge_adjacency(const Tri_List &tris,
+                                             int vertex_bits,
+                                             const Half_Edge_Keys &codec) {
+  const size_t num_half_edges = tris.size() * 3;
+  std::vector<typename Half_Edge_Keys::Item> half_edges(num_half_edges);
+  parallel_for(tris.size(), [&](size_t i) {
+    const auto &t = tris[i];
+    for (int k = 0; k < 3; k++) {
+      uint32_t a = t[k], b = t[(k + 1) % 3];
+      uint64_t key = a < b ? uint64_t(a) << vertex_bits | b
+                           : uint64_t(b) << vertex_bits | a;
+      half_edges[i * 3 + k] = codec.make(key, uint32_t(i * 3 + k));
+    }
+  });
+  radix_sort(half_edges, [&](const typename Half_Edge_Keys::Item &h) {
+    return codec.key(h);
+  });
+
+  auto is_first = [&](size_t i) {
+    return i == 0 || codec.key(half_edges[i]) != codec.key(half_edges[i - 1]);
+  };
+  // Edge index of every first half-edge
+  std::vector<uint32_t> edge_indices(num_half_edges, 0);
+  parallel_for(num_half_edges, [&](size_t i) {
+    if (is_first(i)) {
+      edge_indices[codec.index(half_edges[i])] = 1;
+    }
+  });
+  size_t num_edges =
+      parallel_exclusive_scan(edge_indices.data(), num_half_edges);
+
+  Csr_Adjacency adjacency;
+  adjacency.offsets.resize(num_edges + 1);
+  auto for_each_run = [&](auto &&f) {
+    parallel_for(num_half_edges, [&](size_t i) {
+      if (is_first(i)) {
+        size_t last = i + 1;
+        while (last < num_half_edges && !is_first(last)) {
+          last++;
+        }
+        f(edge_indices[codec.index(half_edges[i])], i, last);
+      }
+    });
+  };
+  for_each_run([&](uint32_t edge, size_t first, size_t last) {
+    adjacency.offsets[edge] = uint32_t(last - first);
+  });
+  adjacency.offsets[num_edges] =
+      parallel_exclusive_scan(adjacency.offsets.data(), num_edges);
+  adjacency.indices.resize(num_half_edges);
+  for_each_run([&](uint32_t edge, size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+      adjacency.indices[adjacency.offsets[edge] + i - first] =
+          codec.index(half_edges[i]);
+    }
+  });
+  return adjacency;
+}
+
+// Half-edges of every undirected edge in ascending order, where half-edge
+// 3 * t + k goes from corner k to corner k + 1 of triangle t. Edges are
+// numbered in the order they first appear in the triangles.
+//
+// Half-edges are keyed by their edge and radix sorted, which keeps the
+// half-edges of every edge in order, so the first of every run of equal keys
+// is the edge's first appearance. Keys pack both vertices into as few bits as
+// the vertex count allows, and when the half-edge index fits next to the key
+// they are sorted as single 64-bit words.
+inline Csr_Adjacency build_edge_half_edge_adjacency(const Tri_List &tris,
+                                                    size_t num_vertices) {
+  auto count_bits = [](uint64_t n) {
+    int bits = 1;
+    while (bits < 64 && (uint64_t(1) << bits) < n) {
+      bits++;
+    }
+    return bits;
+  };
+  int vertex_bits = count_bits(num_vertices);
+  int index_bits = count_bits(tris.size() * 3);
+  if (vertex_bits * 2 + index_bits <= 64) {
+    return build_edge_half_edge_adjacency(tris, vertex_bits,
+                                          Packed_Half_Edge_Keys{index_bits});
+  }
+  return build_edge_half_edge_adjacency(tris, vertex_bits,
+                                        Wide_Half_Edge_Keys{});
+}
@@ -0,0 +1,55 @@
+#include <cctype>
+#include <cstring>
+
+#include "gpm_io.hpp"
+#include "mesh_io.hpp"
+#include "off_io.hpp"
+#include "ply_io.hpp"
+#include "stl_io.hpp"
+
+static bool has_extension(const char *path, const char *extension) {
+  size_t path_size = std::strlen(path);
+  size_t extension_size = std::strlen(extension);
+  if (path_size < extension_size) {
+    return false;
+  }
+  const char *suffix = path + path_size - extension_size;
+  for (size_t i = 0; i < extension_size; i++) {
+    if (std::tolower(suffix[i]) != extension[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool read_indexed_mesh(const char *path, Indexed_Tri_Mesh<double> &mesh) {
+  if (has_extension(path, ".gpm")) {
+    return read_gpm(path, mesh);
+  }
+  if (has_extension(path, ".ply")) {
+    return read_ply_mesh(path, mesh);
+  }
+  if (has_extension(path, ".off")) {
+    mesh = read_off<double>(path).triangulate();
+    return true;
+  }
+  mesh = Indexed_Tri_Mesh<double>::from_stl_tris(read_stl(path));
+  return true;
+}
+
+void write_indexed_mesh(const char *path,
+                        const Indexed_Tri_Mesh<double> &mesh) {
+  if (has_extension(path, ".gpm")) {
+    write_gpm(path, mesh);
+  } else if (has_extension(path, ".ply")) {
+    write_ply_mesh(path, mesh);
+  } else {
+    write_stl_binary(path, mesh.to_tris());
+  }
+}
+
+bool is_gpm_path(const char *path) { return has_extension(path, ".gpm"); }
+
+bool is_indexed_mesh_path(const char *path) {
+  return has_extension(path, ".gpm") || has_extension(path, ".ply");
+}
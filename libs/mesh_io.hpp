@@ -0,0 +1,15 @@
+#pragma once
+
+#include "indexed_tri_mesh.hpp"
+
+// Picks the format from the file extension. GPM and PLY meshes keep their
+// indexing, OFF meshes are triangulated and anything else is read as STL and
+// welded. Returns false if the file could not be read.
+bool read_indexed_mesh(const char *path, Indexed_Tri_Mesh<double> &mesh);
+// Writes .gpm and .ply files as indexed meshes and anything else as binary
+// STL.
+void write_indexed_mesh(const char *path, const Indexed_Tri_Mesh<double> &mesh);
+// True for the formats write_indexed_mesh keeps indexed, everything else is
+// written as binary STL.
+bool is_indexed_mesh_path(const char *path);
+bool is_gpm_path(const char *path);
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "indexed_tri_mesh.hpp"
+#include "mesh_adjacency.hpp"
+#include "parallel.hpp"
+
+// Label of vertices that are not used by any triangle
+constexpr uint32_t no_island = std::numeric_limits<uint32_t>::max();
+
+// Root of the component of every vertex, vertices are connected through
+// triangles. Triangles are united in parallel with a lock-free union-find,
+// where roots are only ever linked below smaller roots with a compare and
+// swap. The root of every component is therefore its smallest vertex, which
+// does not depend on the number of threads.
+inline std::vector<uint32_t> find_vertex_roots(const Tri_List &tris,
+                                               size_t num_vertices) {
+  std::vector<std::atomic<uint32_t>> parents(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) {
+    parents[i].store(uint32_t(i), std::memory_order_relaxed);
+  });
+  // Path halving, parents only ever move to an ancestor so concurrent
+  // updates can be lost without breaking the forest.
+  auto find = [&](uint32_t v) {
+    while (true) {
+      uint32_t p = parents[v].load(std::memory_order_relaxed);
+      if (p == v) {
+        return v;
+      }
+      uint32_t gp = parents[p].load(std::memory_order_relaxed);
+      if (gp != p) {
+        parents[v].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      }
+      v = gp;
+    }
+  };
+  auto unite = [&](uint32_t a, uint32_t b) {
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b) {
+        return;
+      }
+      if (a < b) {
+        std::swap(a, b);
+      }
+      uint32_t expected = a;
+      if (parents[a].compare_exchange_strong(expected, b)) {
+        return;
+      }
+    }
+  };
+  parallel_for(tris.size(), [&](size_t i) {
+    const auto &t = tris[i];
+    unite(t[0], t[1]);
+    unite(t[0], t[2]);
+  });
+  std::vector<uint32_t> roots(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) { roots[i] = find(uint32_t(i)); });
+  return roots;
+}
+
+// Elements of every label in ascending order, elements labelled no_island
+// are left out.
+inline Csr_Adjacency group_by_label(const std::vector<uint32_t> &labels,
+                                    size_t num_labels) {
+  Csr_Adjacency groups;
+  groups.offsets.resize(num_labels + 1);
+  std::vector<std::atomic<uint32_t>> counters(num_labels);
+  parallel_for(num_labels, [&](size_t i) { counters[i] = 0; });
+  parallel_for(labels.size(), [&](size_t i) {
+    if (labels[i] != no_island) {
+      counters[labels[i]].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  parallel_for(num_labels, [&](size_t i) { groups.offsets[i] = counters[i]; });
+  groups.offsets[num_labels] =
+      parallel_exclusive_scan(groups.offsets.data(), num_labels);
+  parallel_for(num_labels, [&](size_t i) { counters[i] = groups.offsets[i]; });
+
+  groups.indices.resize(groups.offsets[num_labels]);
+  parallel_for(labels.size(), [&](size_t i) {
+    if (labels[i] != no_island) {
+      uint32_t slot =
+          counters[labels[i]].fetch_add(1, std::memory_order_relaxed);
+      groups.indices[slot] = uint32_t(i);
+    }
+  });
+  parallel_for(
+      num_labels,
+      [&](size_t i) {
+        std::sort(groups.indices.begin() + groups.offsets[i],
+                  groups.indices.begin() + groups.offsets[i + 1]);
+      },
+      1);
+  return groups;
+}
+
+// Connected components of a triangle mesh. Islands are numbered in the order
+// of their smallest vertex.
+struct Mesh_Islands {
+  std::vector<uint32_t> tri_labels;
+  // Triangles and vertices of every island in ascending order
+  Csr_Adjacency tris;
+  Csr_Adjacency vertices;
+  // Index of every vertex within the vertices of its island
+  std::vector<uint32_t> local_vertex_indices;
+
+  size_t size() const { return tris.size(); }
+};
+
+// Island of every vertex, or no_island for vertices without triangles.
+inline std::vector<uint32_t> find_vertex_islands(const Tri_List &tris,
+                                                 size_t num_vertices,
+                                                 size_t &num_islands) {
+  auto roots = find_vertex_roots(tris, num_vertices);
+  // Roots of components with triangles get consecutive island numbers
+  std::vector<std::atomic<uint8_t>> has_tris(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) {
+    has_tris[i].store(0, std::memory_order_relaxed);
+  });
+  parallel_for(tris.size(), [&](size_t i) {
+    has_tris[roots[tris[i][0]]].store(1, std::memory_order_relaxed);
+  });
+  std::vector<uint32_t> island_indices(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) {
+    island_indices[i] = has_tris[i].load(std::memory_order_relaxed);
+  });
+  num_islands =
+      parallel_exclusive_scan(island_indices.data(), island_indices.size());
+  parallel_for(num_vertices, [&](size_t i) {
+    roots[i] = has_tris[roots[i]].load(std::memory_order_relaxed)
+                   ? island_indices[roots[i]]
+                   : no_island;
+  });
+  return roots;
+}
+
+// Island of every triangle, for when the islands themselves are not needed.
+inline std::vector<uint32_t> find_tri_islands(const Tri_List &tris,
+                                              size_t num_vertices,
+                                              size_t &num_islands) {
+  auto vertex_islands = find_vertex_islands(tris, num_vertices, num_islands);
+  std::vector<uint32_t> tri_labels(tris.size());
+  parallel_for(tris.size(), [&](size_t i) {
+    tri_labels[i] = vertex_islands[tris[i][0]];
+  });
+  return tri_labels;
+}
+
+inline Mesh_Islands find_mesh_islands(const Tri_List &tris,
+                                      size_t num_vertices) {
+  Mesh_Islands islands;
+  size_t num_islands = 0;
+  auto vertex_islands = find_vertex_islands(tris, num_vertices, num_islands);
+  islands.tri_labels.resize(tris.size());
+  parallel_for(tris.size(), [&](size_t i) {
+    islands.tri_labels[i] = vertex_islands[tris[i][0]];
+  });
+  islands.tris = group_by_label(islands.tri_labels, num_islands);
+  islands.vertices = group_by_label(vertex_islands, num_islands);
+  islands.local_vertex_indices.assign(num_vertices, no_island);
+  parallel_for(
+      num_islands,
+      [&](size_t i) {
+        auto island_vertices = islands.vertices[i];
+        for (size_t k = 0; k < island_vertices.size(); k++) {
+          islands.local_vertex_indices[island_vertices.first[k]] = uint32_t(k);
+        }
+      },
+      64);
+  return islands;
+}
+
+// Copies island i into a mesh of its own, only the island's vertices are
+// kept.
+template <typename T>
+Indexed_Tri_Mesh<T> extract_island(const Indexed_Tri_Mesh<T> &mesh,
+                                   const Mesh_Islands &islands, size_t i) {
+  Indexed_Tri_Mesh<T> island;
+  auto island_vertices = islands.vertices[i];
+  island.vertices.reserve(island_vertices.size());
+  for (auto vi : island_vertices) {
+    island.vertices.push_back(mesh.vertices[vi]);
+  }
+  auto island_tris = islands.tris[i];
+  island.tris.reserve(island_tris.size());
+  for (auto ti : island_tris) {
+    std::array<uint32_t, 3> t;
+    for (int k = 0; k < 3; k++) {
+      t[k] = islands.local_vertex_indices[mesh.tris[ti][k]];
+    }
+    island.tris.push_back(t);
+  }
+  return island;
+}
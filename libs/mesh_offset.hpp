@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "indexed_tri_mesh.hpp"
+#include "parallel.hpp"
+#include "triangle.hpp"
+#include "vec3.hpp"
+
+// Cells per block side of the sparse distance field
+constexpr int offset_block_size = 8;
+
+// Distance and side queries against a closed mesh
+template <typename T> struct Distance_Field {
+  BVH bvh;
+  const std::vector<Triangle<T>> &tris;
+
+  // Distance to the mesh clamped to max_distance, which bounds the search.
+  // Below min_distance any distance below it may be returned.
+  T calc_distance(const Vec3<T> &point, T max_distance, T min_distance = 0) {
+    T distance_squared =
+        bvh.find_closest_tri(point, tris, max_distance, min_distance)
+            .distance_squared;
+    return std::min(std::sqrt(distance_squared), max_distance);
+  }
+
+  // Majority of the parities of three rays
+  bool is_inside(const Vec3<T> &point) {
+    // Directions that are unlikely to run along edges of axis aligned meshes
+    static const Vec3<T> directions[3] = {
+        Vec3<T>(T(0.8017), T(0.5345), T(0.2673)),
+        Vec3<T>(T(-0.3015), T(0.9045), T(-0.3015)),
+        Vec3<T>(T(0.2182), T(-0.4364), T(-0.8729)),
+    };
+    int num_odd = 0;
+    for (const auto &direction : directions) {
+      Ray<T> ray(point, direction);
+      num_odd += bvh.count_intersections(ray, tris) % 2;
+    }
+    return num_odd >= 2;
+  }
+};
+
+// Surface of one tetrahedron whose corners are positively oriented, corners
+// with negative values are inside. Edge points are interpolated from the
+// corner with the smaller key so that every tetrahedron sharing an edge
+// computes the same point.
+template <typename T>
+void polygonize_tetrahedron(const Vec3<T> *points, const T *values,
+                            const uint64_t *keys,
+                            std::vector<Triangle<T>> &out) {
+  auto edge_point = [&](int a, int b) {
+    if (keys[b] < keys[a]) {
+      std::swap(a, b);
+    }
+    T t = values[a] / (values[a] - values[b]);
+    return points[a] + (points[b] - points[a]) * t;
+  };
+  // Even permutations starting with every corner
+  static const int even_perms[4][4] = {
+      {0, 1, 2, 3}, {1, 0, 3, 2}, {2, 3, 0, 1}, {3, 2, 1, 0}};
+  int inside_mask = 0;
+  int num_inside = 0;
+  for (int i = 0; i < 4; i++) {
+    inside_mask |= (values[i] < 0) << i;
+    num_inside += values[i] < 0;
+  }
+  if (num_inside == 0 || num_inside == 4) {
+    return;
+  }
+  if (num_inside == 1 || num_inside == 3) {
+    // Lone corner
+    int lone = 0;
+    while (((inside_mask >> lone) & 1) != (num_inside == 1)) {
+      lone++;
+    }
+    const int *p = even_perms[lone];
+    auto a = edge_point(p[0], p[1]);
+    auto b = edge_point(p[0], p[2]);
+    auto c = edge_point(p[0], p[3]);
+    if (num_inside == 1) {
+      out.push_back({a, b, c});
+    } else {
+      out.push_back({a, c, b});
+    }
+    return;
+  }
+  // Two inside corners i and j, rotated into an even permutation i, j, k, l
+  int i = 0;
+  while (!((inside_mask >> i) & 1)) {
+    i++;
+  }
+  int p[4];
+  for (int k = 0; k < 4; k++) {
+    p[k] = even_perms[i][k];
+  }
+  while (!((inside_mask >> p[1]) & 1)) {
+    int first = p[1];
+    p[1] = p[2];
+    p[2] = p[3];
+    p[3] = first;
+  }
+  auto ik = edge_point(p[0], p[2]);
+  auto il = edge_point(p[0], p[3]);
+  auto jl = edge_point(p[1], p[3]);
+  auto jk = edge_point(p[1], p[2]);
+  out.push_back({ik, il, jl});
+  out.push_back({ik, jl, jk});
+}
+
+// Offsets a closed mesh by a signed distance, outwards when positive, and
+// returns a surface without self-intersections. The signed distance field is
+// sampled on a grid of voxel_size cubes split into blocks. Distances change
+// no faster than points move, so blocks whose centre is farther from the
+// offset surface than their half-diagonal are skipped after one query. The
+// other blocks are sampled and polygonized with marching tetrahedra in
+// parallel, six tetrahedra around the main diagonal of every cube, and their
+// triangles are welded in block order. Offsets should be at least a voxel
+// diagonal, as the side of the mesh is not sampled closer to it than the
+// offset.
+template <typename T>
+Indexed_Tri_Mesh<T> offset_mesh(const Indexed_Tri_Mesh<T> &mesh, T offset,
+                                T voxel_size) {
+  constexpr int b = offset_block_size;
+  if (mesh.tris.empty()) {
+    return {};
+  }
+  auto tris = mesh.to_tris();
+  std::vector<AABB<float>> aabbs(tris.size());
+  parallel_for(tris.size(), [&](size_t i) {
+    const auto &t = tris[i];
+    aabbs[i] = Triangle<float>{t.a.template as<float>(),
+                               t.b.template as<float>(),
+                               t.c.template as<float>()}
+                   .calc_aabb();
+  });
+  Distance_Field<T> field{build_bvh(aabbs), tris};
+  const T abs_offset = std::abs(offset);
+
+  AABB<T> bounds(mesh.vertices[0], mesh.vertices[0]);
+  for (const auto &v : mesh.vertices) {
+    bounds = bounds.join(AABB<T>(v, v));
+  }
+  // The extra half voxel keeps the offsets of faces on the bounds off the
+  // grid points
+  T margin = std::max(offset, T(0)) + voxel_size * T(2.5);
+  Vec3<T> origin = bounds.min - Vec3<T>(margin, margin, margin);
+  std::array<uint64_t, 3> num_blocks;
+  for (int i = 0; i < 3; i++) {
+    T extent = bounds.max[i] - bounds.min[i] + margin * 2;
+    num_blocks[i] = uint64_t(std::ceil(extent / (voxel_size * b)));
+  }
+  const uint64_t num_points_x = num_blocks[0] * b + 1;
+  const uint64_t num_points_y = num_blocks[1] * b + 1;
+  auto get_point = [&](uint64_t x, uint64_t y, uint64_t z) {
+    return origin + Vec3<T>(T(x), T(y), T(z)) * voxel_size;
+  };
+
+  // Corners of the tetrahedra around the diagonal from corner 0 to corner 7
+  // of a cube, whose corner x + 2y + 4z is offset by x, y and z
+  static const int tetrahedra[6][4] = {{0, 1, 3, 7}, {0, 2, 6, 7},
+                                       {0, 4, 5, 7}, {0, 1, 7, 5},
+                                       {0, 2, 7, 3}, {0, 4, 7, 6}};
+  const T block_radius = voxel_size * b * T(std::sqrt(3.0) / 2);
+  const size_t total_blocks = num_blocks[0] * num_blocks[1] * num_blocks[2];
+  std::vector<std::vector<Triangle<T>>> block_tris(total_blocks);
+  parallel_for(
+      total_blocks,
+      [&](size_t block) {
+        uint64_t bx = block % num_blocks[0];
+        uint64_t by = block / num_blocks[0] % num_blocks[1];
+        uint64_t bz = block / num_blocks[0] / num_blocks[1];
+        Vec3<T> center =
+            (get_point(bx * b, by * b, bz * b) +
+             get_point(bx * b + b, by * b + b, bz * b + b)) /
+            T(2);
+        T distance =
+            field.calc_distance(center, abs_offset + block_radius);
+        if (std::abs(distance - abs_offset) >= block_radius) {
+          return;
+        }
+        // Signed, this also skips blocks on the other side of the mesh
+        T signed_distance = field.is_inside(center) ? -distance : distance;
+        if (std::abs(signed_distance - offset) >= block_radius) {
+          return;
+        }
+        constexpr int n = b + 1;
+        auto get_corner_point = [&](int i) {
+          return get_point(bx * b + i % n, by * b + i / n % n,
+                           bz * b + i / (n * n));
+        };
+        // Edges only cross the offset surface between corners within a
+        // voxel diagonal of it, other corners only need their side
+        std::vector<T> distances(n * n * n);
+        for (int i = 0; i < n * n * n; i++) {
+          distances[i] = field.calc_distance(
+              get_corner_point(i), abs_offset + voxel_size * 2,
+              std::max(abs_offset - voxel_size * 2, T(0)));
+        }
+        // Corners closer to the mesh than the offset are on the same side of
+        // the offset surface whichever side of the mesh they are on. Farther
+        // corners joined by edges that cannot cross the mesh are on the same
+        // side of it, so every such group only casts rays once.
+        std::vector<int8_t> signs(n * n * n, 0);
+        std::vector<int> stack;
+        auto is_far = [&](int i) { return distances[i] >= abs_offset; };
+        for (int i = 0; i < n * n * n; i++) {
+          if (!is_far(i) || signs[i] != 0) {
+            continue;
+          }
+          int8_t sign = field.is_inside(get_corner_point(i)) ? -1 : 1;
+          signs[i] = sign;
+          stack.push_back(i);
+          while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            int coords[3] = {c % n, c / n % n, c / (n * n)};
+            for (int axis = 0; axis < 3; axis++) {
+              for (int step : {-1, 1}) {
+                int coord = coords[axis] + step;
+                if (coord < 0 || coord >= n) {
+                  continue;
+                }
+                int neighbour = c + step * (axis == 0   ? 1
+                                            : axis == 1 ? n
+                                                        : n * n);
+                if (signs[neighbour] == 0 && is_far(neighbour) &&
+                    (distances[c] > voxel_size ||
+                     distances[neighbour] > voxel_size)) {
+                  signs[neighbour] = sign;
+                  stack.push_back(neighbour);
+                }
+              }
+            }
+          }
+        }
+        std::vector<T> values(n * n * n);
+        for (int i = 0; i < n * n * n; i++) {
+          T d = distances[i];
+          T value = signs[i] != 0 ? signs[i] * d - offset
+                    : offset > 0  ? d - abs_offset
+                                  : abs_offset - d;
+          // Keeps edge points off the corners, where the points of
+          // different edges would be welded together
+          T min_value = voxel_size * T(1e-6);
+          values[i] = std::abs(value) < min_value ? min_value : value;
+        }
+        auto &out = block_tris[block];
+        for (int z = 0; z < b; z++) {
+          for (int y = 0; y < b; y++) {
+            for (int x = 0; x < b; x++) {
+              Vec3<T> points[8] = {
+                  {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0},
+                  {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+              T cube_values[8];
+              uint64_t keys[8];
+              for (int c = 0; c < 8; c++) {
+                int cx = x + (c & 1), cy = y + (c >> 1 & 1), cz = z + (c >> 2);
+                uint64_t gx = bx * b + cx, gy = by * b + cy, gz = bz * b + cz;
+                points[c] = get_point(gx, gy, gz);
+                cube_values[c] = values[(cz * n + cy) * n + cx];
+                keys[c] = (gz * num_points_y + gy) * num_points_x + gx;
+              }
+              for (const auto &tet : tetrahedra) {
+                Vec3<T> tet_points[4] = {points[tet[0]], points[tet[1]],
+                                         points[tet[2]], points[tet[3]]};
+                T tet_values[4];
+                uint64_t tet_keys[4];
+                for (int k = 0; k < 4; k++) {
+                  tet_values[k] = cube_values[tet[k]];
+                  tet_keys[k] = keys[tet[k]];
+                }
+                polygonize_tetrahedron(tet_points, tet_values, tet_keys, out);
+              }
+            }
+          }
+        }
+      },
+      1);
+  field.bvh.free();
+
+  std::vector<Triangle<T>> out_tris;
+  for (auto &t : block_tris) {
+    out_tris.insert(out_tris.end(), t.begin(), t.end());
+  }
+  return Indexed_Tri_Mesh<T>::from_stl_tris(out_tris);
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "indexed_tri_mesh.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+
+// Reordering of vertices and triangles for memory locality. Every function
+// returns an order as new_to_old indices, which is applied with
+// permute_vertices or permute_tris.
+
+enum class Vertex_Order {
+  Morton,
+  Hilbert,
+};
+
+// Spreads the lower 21 bits of x so that there are two zero bits between
+// every bit.
+inline uint64_t spread_bits_3d(uint64_t x) {
+  x &= 0x1FFFFF;
+  x = (x | x << 32) & 0x1F00000000FFFFull;
+  x = (x | x << 16) & 0x1F0000FF0000FFull;
+  x = (x | x << 8) & 0x100F00F00F00F00Full;
+  x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+inline uint64_t morton_code_3d(uint32_t x, uint32_t y, uint32_t z) {
+  return spread_bits_3d(x) << 2 | spread_bits_3d(y) << 1 | spread_bits_3d(z);
+}
+
+// Index along a Hilbert curve through a grid of 2^21 cells per axis, using
+// Skilling's transform of the coordinates to the transposed Hilbert index:
+// https://doi.org/10.1063/1.1751381
+inline uint64_t hilbert_index_3d(uint32_t x, uint32_t y, uint32_t z) {
+  constexpr int num_bits = 21;
+  uint32_t axes[3] = {x, y, z};
+  for (uint32_t q = 1u << (num_bits - 1); q > 1; q >>= 1) {
+    uint32_t p = q - 1;
+    for (int i = 0; i < 3; i++) {
+      if (axes[i] & q) {
+        axes[0] ^= p;
+      } else {
+        uint32_t t = (axes[0] ^ axes[i]) & p;
+        axes[0] ^= t;
+        axes[i] ^= t;
+      }
+    }
+  }
+  axes[1] ^= axes[0];
+  axes[2] ^= axes[1];
+  uint32_t t = 0;
+  for (uint32_t q = 1u << (num_bits - 1); q > 1; q >>= 1) {
+    if (axes[2] & q) {
+      t ^= q - 1;
+    }
+  }
+  for (auto &a : axes) {
+    a ^= t;
+  }
+  return morton_code_3d(axes[0], axes[1], axes[2]);
+}
+
+// Sorts vertices along a space filling curve through their bounding box.
+template <typename T>
+std::vector<uint32_t> calc_spatial_vertex_order(const Indexed_Tri_Mesh<T> &mesh,
+                                                Vertex_Order order) {
+  const size_t n = mesh.vertices.size();
+  std::vector<std::pair<uint64_t, uint32_t>> keys(n);
+  if (n == 0) {
+    return {};
+  }
+  Vec3<T> min = mesh.vertices[0];
+  Vec3<T> max = mesh.vertices[0];
+  for (const auto &v : mesh.vertices) {
+    min = min.min(v);
+    max = max.max(v);
+  }
+  auto extent = max - min;
+  T max_extent = std::max({extent.x, extent.y, extent.z});
+  T scale = max_extent > 0 ? T((1 << 21) - 1) / max_extent : T(0);
+  parallel_for(n, [&](size_t i) {
+    auto c = (mesh.vertices[i] - min) * scale;
+    uint32_t x = uint32_t(c.x), y = uint32_t(c.y), z = uint32_t(c.z);
+    uint64_t key = order == Vertex_Order::Morton ? morton_code_3d(x, y, z)
+                                                 : hilbert_index_3d(x, y, z);
+    keys[i] = {key, uint32_t(i)};
+  });
+  std::sort(keys.begin(), keys.end());
+  std::vector<uint32_t> new_to_old(n);
+  for (size_t i = 0; i < n; i++) {
+    new_to_old[i] = keys[i].second;
+  }
+  return new_to_old;
+}
+
+// Orders vertices by their first use in the triangle list, unused vertices
+// keep their relative order at the end.
+template <typename T>
+std::vector<uint32_t>
+calc_first_use_vertex_order(const Indexed_Tri_Mesh<T> &mesh) {
+  std::vector<uint8_t> is_used(mesh.vertices.size(), 0);
+  std::vector<uint32_t> new_to_old;
+  new_to_old.reserve(mesh.vertices.size());
+  for (const auto &t : mesh.tris) {
+    for (auto vi : t) {
+      if (!is_used[vi]) {
+        is_used[vi] = 1;
+        new_to_old.push_back(vi);
+      }
+    }
+  }
+  for (size_t i = 0; i < is_used.size(); i++) {
+    if (!is_used[i]) {
+      new_to_old.push_back(uint32_t(i));
+    }
+  }
+  return new_to_old;
+}
+
+// Triangle order for post-transform vertex cache reuse, following Tom
+// Forsyth's linear-speed vertex cache optimisation:
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+// The next triangle is always the best scoring one using a vertex in the
+// simulated LRU cache, so the cost is linear in the number of triangles.
+template <typename T>
+std::vector<uint32_t>
+calc_vertex_cache_tri_order(const Indexed_Tri_Mesh<T> &mesh,
+                            size_t cache_size = 32) {
+  const size_t num_vertices = mesh.vertices.size();
+  const size_t num_tris = mesh.tris.size();
+
+  // Triangles of every vertex, live ones are kept at the front of the range
+  std::vector<uint32_t> offsets(num_vertices + 1, 0);
+  for (const auto &t : mesh.tris) {
+    for (auto vi : t) {
+      offsets[vi + 1]++;
+    }
+  }
+  for (size_t i = 0; i < num_vertices; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+  std::vector<uint32_t> vertex_tris(offsets.back());
+  {
+    std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < num_tris; i++) {
+      for (auto vi : mesh.tris[i]) {
+        vertex_tris[cursors[vi]++] = uint32_t(i);
+      }
+    }
+  }
+  std::vector<uint32_t> num_live_tris(num_vertices);
+  for (size_t i = 0; i < num_vertices; i++) {
+    num_live_tris[i] = offsets[i + 1] - offsets[i];
+  }
+
+  // Scores are looked up from tables indexed by cache position and by the
+  // number of live triangles
+  constexpr uint32_t max_tabled_live_tris = 64;
+  std::vector<float> cache_scores(cache_size + 1, 0.0f);
+  for (size_t i = 0; i < cache_size; i++) {
+    // The vertices of the last triangle are scored equally, so the
+    // optimisation does not depend on their order.
+    cache_scores[i] =
+        i < 3 ? 0.75f
+              : std::pow(1.0f - float(i - 3) / float(cache_size - 3), 1.5f);
+  }
+  std::vector<float> live_tri_scores(max_tabled_live_tris);
+  for (uint32_t i = 1; i < max_tabled_live_tris; i++) {
+    live_tri_scores[i] = 2.0f / std::sqrt(float(i));
+  }
+  auto calc_vertex_score = [&](int cache_position, uint32_t num_live) {
+    if (num_live == 0) {
+      return -1.0f;
+    }
+    float score = cache_position >= 0 ? cache_scores[cache_position] : 0.0f;
+    return score + (num_live < max_tabled_live_tris
+                        ? live_tri_scores[num_live]
+                        : 2.0f / std::sqrt(float(num_live)));
+  };
+
+  std::vector<int> cache_positions(num_vertices, -1);
+  std::vector<float> vertex_scores(num_vertices);
+  for (size_t i = 0; i < num_vertices; i++) {
+    vertex_scores[i] = calc_vertex_score(-1, num_live_tris[i]);
+  }
+  std::vector<float> tri_scores(num_tris);
+  for (size_t i = 0; i < num_tris; i++) {
+    const auto &t = mesh.tris[i];
+    tri_scores[i] =
+        vertex_scores[t[0]] + vertex_scores[t[1]] + vertex_scores[t[2]];
+  }
+
+  std::vector<uint8_t> is_emitted(num_tris, 0);
+  std::vector<uint32_t> new_to_old;
+  new_to_old.reserve(num_tris);
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> next_cache;
+  cache.reserve(cache_size + 3);
+  next_cache.reserve(cache_size + 3);
+  size_t next_unemitted = 0;
+  int64_t best_tri = -1;
+  while (new_to_old.size() < num_tris) {
+    if (best_tri < 0) {
+      while (is_emitted[next_unemitted]) {
+        next_unemitted++;
+      }
+      best_tri = int64_t(next_unemitted);
+    }
+    const auto &t = mesh.tris[best_tri];
+    is_emitted[best_tri] = 1;
+    new_to_old.push_back(uint32_t(best_tri));
+
+    // Remove the triangle from the live triangles of its vertices
+    for (auto vi : t) {
+      uint32_t *begin = vertex_tris.data() + offsets[vi];
+      uint32_t *end = begin + num_live_tris[vi];
+      std::swap(*std::find(begin, end, uint32_t(best_tri)), *(end - 1));
+      num_live_tris[vi]--;
+    }
+
+    // Move the triangle's vertices to the front of the cache
+    next_cache.clear();
+    for (auto vi : t) {
+      if (std::find(next_cache.begin(), next_cache.end(), vi) ==
+          next_cache.end()) {
+        next_cache.push_back(vi);
+      }
+    }
+    for (auto vi : cache) {
+      if (vi != t[0] && vi != t[1] && vi != t[2]) {
+        next_cache.push_back(vi);
+      }
+    }
+    std::swap(cache, next_cache);
+    for (size_t i = 0; i < cache.size(); i++) {
+      uint32_t vi = cache[i];
+      cache_positions[vi] = i < cache_size ? int(i) : -1;
+      vertex_scores[vi] = calc_vertex_score(cache_positions[vi],
+                                            num_live_tris[vi]);
+    }
+
+    // Rescore live triangles touching the cache and pick the best one
+    best_tri = -1;
+    float best_score = -1.0f;
+    for (auto vi : cache) {
+      for (uint32_t j = 0; j < num_live_tris[vi]; j++) {
+        uint32_t ti = vertex_tris[offsets[vi] + j];
+        const auto &other = mesh.tris[ti];
+        tri_scores[ti] = vertex_scores[other[0]] + vertex_scores[other[1]] +
+                         vertex_scores[other[2]];
+        if (tri_scores[ti] > best_score) {
+          best_score = tri_scores[ti];
+          best_tri = ti;
+        }
+      }
+    }
+    if (cache.size() > cache_size) {
+      cache.resize(cache_size);
+    }
+  }
+  return new_to_old;
+}
+
+// Average number of vertex cache misses per triangle for a FIFO cache.
+template <typename T>
+double calc_average_cache_miss_ratio(const Indexed_Tri_Mesh<T> &mesh,
+                                     size_t cache_size = 32) {
+  if (mesh.tris.empty()) {
+    return 0.0;
+  }
+  std::vector<size_t> insertion_times(mesh.vertices.size(), 0);
+  size_t time = 0;
+  size_t num_misses = 0;
+  for (const auto &t : mesh.tris) {
+    for (auto vi : t) {
+      if (insertion_times[vi] == 0 ||
+          time - insertion_times[vi] >= cache_size) {
+        insertion_times[vi] = ++time;
+        num_misses++;
+      }
+    }
+  }
+  return double(num_misses) / mesh.tris.size();
+}
+
+template <typename T>
+void permute_vertices(Indexed_Tri_Mesh<T> &mesh,
+                      const std::vector<uint32_t> &new_to_old) {
+  std::vector<uint32_t> old_to_new(new_to_old.size());
+  std::vector<Vec3<T>> vertices(new_to_old.size(), Vec3<T>(0, 0, 0));
+  parallel_for(new_to_old.size(), [&](size_t i) {
+    old_to_new[new_to_old[i]] = uint32_t(i);
+    vertices[i] = mesh.vertices[new_to_old[i]];
+  });
+  mesh.vertices = std::move(vertices);
+  parallel_for(mesh.tris.size(), [&](size_t i) {
+    for (auto &vi : mesh.tris[i]) {
+      vi = old_to_new[vi];
+    }
+  });
+}
+
+template <typename T>
+void permute_tris(Indexed_Tri_Mesh<T> &mesh,
+                  const std::vector<uint32_t> &new_to_old) {
+  std::vector<std::array<uint32_t, 3>> tris(new_to_old.size());
+  parallel_for(new_to_old.size(),
+               [&](size_t i) { tris[i] = mesh.tris[new_to_old[i]]; });
+  mesh.tris = std::move(tris);
+}
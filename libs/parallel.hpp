@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Number of worker threads, defaults to the hardware concurrency and can be
+// overridden with the GEOPROC_NUM_THREADS environment variable.
+inline size_t get_num_threads() {
+  static const size_t num_threads = []() -> size_t {
+    if (const char *env = std::getenv("GEOPROC_NUM_THREADS")) {
+      size_t n = std::strtoull(env, nullptr, 10);
+      if (n > 0) {
+        return n;
+      }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }();
+  return num_threads;
+}
+
+// Set on threads running inside a parallel region, nested parallel loops run
+// serially on the calling thread instead of oversubscribing the machine.
+inline thread_local bool in_parallel_region = false;
+
+// Calls f(thread_idx) on num_threads threads, including the calling thread.
+template <typename F> void run_on_threads(size_t num_threads, F &&f) {
+  if (num_threads <= 1 || in_parallel_region) {
+    f(size_t(0));
+    return;
+  }
+  auto worker = [&](size_t thread_idx) {
+    in_parallel_region = true;
+    f(thread_idx);
+    in_parallel_region = false;
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+// Splits [0, n) into blocks of block_size elements and calls
+// f(block_idx, begin, end) for each block. Blocks are handed out dynamically,
+// but their boundaries only depend on n and block_size, so per-block results
+// are reproducible regardless of the number of threads.
+template <typename F>
+void parallel_for_blocks(size_t n, size_t block_size, F &&f) {
+  if (n == 0) {
+    return;
+  }
+  size_t num_blocks = (n + block_size - 1) / block_size;
+  std::atomic<size_t> next_block{0};
+  run_on_threads(std::min(num_blocks, get_num_threads()), [&](size_t) {
+    for (size_t block = next_block++; block < num_blocks;
+         block = next_block++) {
+      size_t begin = block * block_size;
+      size_t end = std::min(n, begin + block_size);
+      f(block, begin, end);
+    }
+  });
+}
+
+// Calls f(i) for every i in [0, n).
+template <typename F>
+void parallel_for(size_t n, F &&f, size_t block_size = 4096) {
+  parallel_for_blocks(n, block_size, [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      f(i);
+    }
+  });
+}
+
+// Replaces data[i] with the sum of data[0..i) and returns the total. Block
+// sums are computed in parallel and then offset by the sum of the previous
+// blocks.
+template <typename T> T parallel_exclusive_scan(T *data, size_t n) {
+  constexpr size_t block_size = 1 << 16;
+  size_t num_blocks = (n + block_size - 1) / block_size;
+  std::vector<T> block_sums(num_blocks + 1, T(0));
+  parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                         size_t end) {
+    T sum = T(0);
+    for (size_t i = begin; i < end; i++) {
+      T value = data[i];
+      data[i] = sum;
+      sum += value;
+    }
+    block_sums[block + 1] = sum;
+  });
+  for (size_t block = 0; block < num_blocks; block++) {
+    block_sums[block + 1] += block_sums[block];
+  }
+  parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                         size_t end) {
+    for (size_t i = begin; i < end && block > 0; i++) {
+      data[i] += block_sums[block];
+    }
+  });
+  return block_sums[num_blocks];
+}
@@ -1,17 +1,668 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
 
+#include "mapped_file.hpp"
+#include "parallel.hpp"
 #include "ply_io.hpp"
 
+namespace {
+
+// A group of properties that is always written together, in the separate
+// elements layout every group is its own element.
+struct Property_Group {
+  Point_Attribute attribute; // 0 for the position
+  const char *element_name;
+  const char *properties;
+  size_t size;
+};
+
+const Property_Group position_groups[] = {
+    {Point_Attribute(0), "vertex",
+     "property double x\n"
+     "property double y\n"
+     "property double z\n",
+     sizeof(double[3])},
+    {Point_Attribute(0), "vertex",
+     "property float x\n"
+     "property float y\n"
+     "property float z\n",
+     sizeof(float[3])},
+    {Point_Attribute(0), "vertex",
+     "property ushort x\n"
+     "property ushort y\n"
+     "property ushort z\n",
+     sizeof(uint16_t[3])},
+};
+
+const Property_Group attribute_groups[] = {
+    {Point_Normal, "vertex_normal",
+     "property float nx\n"
+     "property float ny\n"
+     "property float nz\n",
+     sizeof(float[3])},
+    {Point_Tri_Index, "vertex_tri_index", "property uint tri_index\n",
+     sizeof(uint32_t)},
+    {Point_Barycentric, "vertex_barycentric",
+     "property float bary_u\n"
+     "property float bary_v\n",
+     sizeof(float[2])},
+    {Point_Color, "vertex_color",
+     "property uchar red\n"
+     "property uchar green\n"
+     "property uchar blue\n",
+     sizeof(uint8_t[3])},
+};
+
+// Groups of a format in file order
+std::vector<const Property_Group *>
+format_groups(const Ply_Points_Format &format) {
+  std::vector<const Property_Group *> groups;
+  groups.push_back(&position_groups[int(format.precision)]);
+  for (const auto &group : attribute_groups) {
+    if (format.attributes & group.attribute) {
+      groups.push_back(&group);
+    }
+  }
+  return groups;
+}
+
+const char *attribute_data(const Property_Group &group,
+                           const Point_Cloud &cloud) {
+  switch (group.attribute) {
+  case Point_Normal:
+    return reinterpret_cast<const char *>(cloud.normals.data());
+  case Point_Tri_Index:
+    return reinterpret_cast<const char *>(cloud.tri_indices.data());
+  case Point_Barycentric:
+    return reinterpret_cast<const char *>(cloud.barycentrics.data());
+  case Point_Color:
+    return reinterpret_cast<const char *>(cloud.colors.data());
+  default:
+    return nullptr;
+  }
+}
+
+Vec3<double> quantization_scale(const AABB<double> &bounds) {
+  auto extent = bounds.calc_extent();
+  Vec3<double> scale(1.0, 1.0, 1.0);
+  for (int i = 0; i < 3; i++) {
+    if (extent[i] > 0) {
+      scale[i] = extent[i] / std::numeric_limits<uint16_t>::max();
+    }
+  }
+  return scale;
+}
+
+// Plain loops over flat arrays, so the conversions get vectorized
+void convert_to_float32(const double *src, size_t count, float *dst) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = float(src[i]);
+  }
+}
+
+void quantize_to_uint16(const double *src, size_t num_points,
+                        const Vec3<double> &offset, const Vec3<double> &scale,
+                        uint16_t *dst) {
+  const double max_value = std::numeric_limits<uint16_t>::max();
+  const double ox = offset.x, oy = offset.y, oz = offset.z;
+  const double ix = 1 / scale.x, iy = 1 / scale.y, iz = 1 / scale.z;
+  for (size_t i = 0; i < num_points; i++) {
+    double qx = (src[3 * i + 0] - ox) * ix + 0.5;
+    double qy = (src[3 * i + 1] - oy) * iy + 0.5;
+    double qz = (src[3 * i + 2] - oz) * iz + 0.5;
+    dst[3 * i + 0] = uint16_t(std::min(std::max(qx, 0.0), max_value));
+    dst[3 * i + 1] = uint16_t(std::min(std::max(qy, 0.0), max_value));
+    dst[3 * i + 2] = uint16_t(std::min(std::max(qz, 0.0), max_value));
+  }
+}
+
+} // namespace
+
+Ply_Points_Writer::Ply_Points_Writer(const char *path, size_t num_points,
+                                     const Ply_Points_Format &format,
+                                     const char *trailing_elements)
+    : ofs(path, std::ios::binary | std::ios::trunc), num_points(num_points),
+      format(format) {
+  ofs << "ply\n"
+      << "format binary_little_endian 1.0\n";
+  if (format.precision == Ply_Precision::Quantized16) {
+    auto offset = format.bounds.min;
+    auto scale = quantization_scale(format.bounds);
+    ofs.precision(17);
+    ofs << "comment quantization offset " << offset.x << ' ' << offset.y
+        << ' ' << offset.z << '\n'
+        << "comment quantization scale " << scale.x << ' ' << scale.y << ' '
+        << scale.z << '\n';
+  }
+  bool is_first_group = true;
+  for (const auto *group : format_groups(format)) {
+    if (is_first_group || format.layout == Ply_Layout::Separate_Elements) {
+      ofs << "element " << group->element_name << ' ' << num_points << '\n';
+    }
+    ofs << group->properties;
+    is_first_group = false;
+  }
+  ofs << trailing_elements << "end_header\n";
+  data_offset = ofs.tellp();
+}
+
+void Ply_Points_Writer::write(const Vec3<double> *points, size_t count) {
+  assert(format.attributes == 0);
+  write(nullptr, points, count);
+}
+
+void Ply_Points_Writer::write(const Point_Cloud &cloud) {
+  assert((cloud.attributes() & format.attributes) == format.attributes);
+  write(&cloud, cloud.points.data(), cloud.size());
+}
+
+const char *Ply_Points_Writer::convert_positions(const Vec3<double> *points,
+                                                 size_t count) {
+  const double *src = &points[0].x;
+  switch (format.precision) {
+  case Ply_Precision::Float32:
+    position_buf.resize(count * sizeof(float[3]));
+    convert_to_float32(src, 3 * count,
+                       reinterpret_cast<float *>(position_buf.data()));
+    return position_buf.data();
+  case Ply_Precision::Quantized16:
+    position_buf.resize(count * sizeof(uint16_t[3]));
+    quantize_to_uint16(src, count, format.bounds.min,
+                       quantization_scale(format.bounds),
+                       reinterpret_cast<uint16_t *>(position_buf.data()));
+    return position_buf.data();
+  default:
+    return reinterpret_cast<const char *>(points);
+  }
+}
+
+void Ply_Points_Writer::write(const Point_Cloud *cloud,
+                              const Vec3<double> *points, size_t count) {
+  assert(num_written + count <= num_points);
+  const auto groups = format_groups(format);
+  size_t stride = 0;
+  for (const auto *group : groups) {
+    stride += group->size;
+  }
+
+  constexpr size_t points_per_batch = 1 << 16;
+  for (size_t begin = 0; begin < count; begin += points_per_batch) {
+    size_t end = std::min(count, begin + points_per_batch);
+    size_t batch_size = end - begin;
+    const char *positions = convert_positions(points + begin, batch_size);
+
+    if (groups.size() == 1) {
+      ofs.write(positions, batch_size * stride);
+      continue;
+    }
+
+    if (format.layout == Ply_Layout::Separate_Elements) {
+      std::streamoff element_offset = data_offset;
+      for (const auto *group : groups) {
+        const char *src = group->attribute == 0
+                              ? positions
+                              : attribute_data(*group, *cloud) +
+                                    begin * group->size;
+        ofs.seekp(element_offset +
+                  std::streamoff((num_written + begin) * group->size));
+        ofs.write(src, batch_size * group->size);
+        element_offset += std::streamoff(num_points * group->size);
+      }
+      continue;
+    }
+
+    buf.resize(stride * batch_size);
+    size_t offset = 0;
+    for (const auto *group : groups) {
+      const char *src =
+          group->attribute == 0
+              ? positions
+              : attribute_data(*group, *cloud) + begin * group->size;
+      for (size_t i = 0; i < batch_size; i++) {
+        std::memcpy(buf.data() + i * stride + offset, src + i * group->size,
+                    group->size);
+      }
+      offset += group->size;
+    }
+    ofs.write(buf.data(), batch_size * stride);
+  }
+  num_written += count;
+}
+
+AABB<double> calc_points_bounds(const std::vector<Vec3<double>> &points) {
+  if (points.empty()) {
+    return AABB<double>();
+  }
+  AABB<double> bounds(points[0], points[0]);
+  for (const auto &p : points) {
+    bounds.min = bounds.min.min(p);
+    bounds.max = bounds.max.max(p);
+  }
+  return bounds;
+}
+
 void write_points_to_ply(const char *path,
                          const std::vector<Vec3<double>> &points) {
-  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
-  ofs << "ply\n"
-      << "format binary_little_endian 1.0\n"
-      << "element vertex " << points.size() << '\n'
-      << "property double x\n"
-      << "property double y\n"
-      << "property double z\n"
-      << "end_header\n";
-  ofs.write(reinterpret_cast<const char *>(points.data()),
-            points.size() * sizeof(Vec3<double>));
-}
\ No newline at end of file
+  Ply_Points_Writer writer(path, points.size());
+  writer.write(points.data(), points.size());
+}
+
+void write_points_to_ply(const char *path, const Point_Cloud &cloud,
+                         Ply_Points_Format format) {
+  if (format.precision == Ply_Precision::Quantized16 &&
+      format.bounds.min == format.bounds.max) {
+    format.bounds = calc_points_bounds(cloud.points);
+  }
+  Ply_Points_Writer writer(path, cloud.size(), format);
+  writer.write(cloud);
+}
+
+namespace {
+
+enum class Ply_Type { Int8, Uint8, Int16, Uint16, Int32, Uint32, F32, F64 };
+
+bool parse_ply_type(const std::string &name, Ply_Type &type) {
+  static const std::pair<const char *, Ply_Type> names[] = {
+      {"char", Ply_Type::Int8},     {"int8", Ply_Type::Int8},
+      {"uchar", Ply_Type::Uint8},   {"uint8", Ply_Type::Uint8},
+      {"short", Ply_Type::Int16},   {"int16", Ply_Type::Int16},
+      {"ushort", Ply_Type::Uint16}, {"uint16", Ply_Type::Uint16},
+      {"int", Ply_Type::Int32},     {"int32", Ply_Type::Int32},
+      {"uint", Ply_Type::Uint32},   {"uint32", Ply_Type::Uint32},
+      {"float", Ply_Type::F32},     {"float32", Ply_Type::F32},
+      {"double", Ply_Type::F64},    {"float64", Ply_Type::F64},
+  };
+  for (const auto &[n, t] : names) {
+    if (name == n) {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t ply_type_size(Ply_Type type) {
+  switch (type) {
+  case Ply_Type::Int8:
+  case Ply_Type::Uint8:
+    return 1;
+  case Ply_Type::Int16:
+  case Ply_Type::Uint16:
+    return 2;
+  case Ply_Type::Int32:
+  case Ply_Type::Uint32:
+  case Ply_Type::F32:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+template <typename T> T load(const char *p) {
+  T value;
+  std::memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+double read_ply_scalar(const char *p, Ply_Type type) {
+  switch (type) {
+  case Ply_Type::Int8:
+    return load<int8_t>(p);
+  case Ply_Type::Uint8:
+    return load<uint8_t>(p);
+  case Ply_Type::Int16:
+    return load<int16_t>(p);
+  case Ply_Type::Uint16:
+    return load<uint16_t>(p);
+  case Ply_Type::Int32:
+    return load<int32_t>(p);
+  case Ply_Type::Uint32:
+    return load<uint32_t>(p);
+  case Ply_Type::F32:
+    return load<float>(p);
+  default:
+    return load<double>(p);
+  }
+}
+
+struct Ply_Property {
+  std::string name;
+  Ply_Type type;
+  bool is_list = false;
+  Ply_Type count_type = Ply_Type::Uint8;
+};
+
+struct Ply_Element {
+  std::string name;
+  size_t count = 0;
+  std::vector<Ply_Property> properties;
+
+  bool has_lists() const {
+    for (const auto &p : properties) {
+      if (p.is_list) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // Only meaningful without list properties
+  size_t stride() const {
+    size_t result = 0;
+    for (const auto &p : properties) {
+      result += ply_type_size(p.type);
+    }
+    return result;
+  }
+  // Size of a row whose lists are all empty
+  size_t min_row_size() const {
+    size_t result = 0;
+    for (const auto &p : properties) {
+      result += ply_type_size(p.is_list ? p.count_type : p.type);
+    }
+    return result;
+  }
+  // Whether count rows of at least row_size bytes can fit before end, checked
+  // before the count from the header is used to allocate or multiply
+  bool fits(size_t row_size, const char *p, const char *end) const {
+    return row_size == 0 || count <= size_t(end - p) / row_size;
+  }
+};
+
+// Parses the header, returns the offset of the binary data or 0 on failure.
+size_t parse_ply_header(const char *data, size_t size,
+                        std::vector<Ply_Element> &elements) {
+  const char end_header[] = "end_header\n";
+  std::string_view file(data, size);
+  size_t header_end = file.find(end_header);
+  if (file.substr(0, 4) != "ply\n" || header_end == file.npos) {
+    return 0;
+  }
+  std::istringstream header(std::string(file.substr(0, header_end)));
+  std::string line;
+  bool is_binary_little_endian = false;
+  while (std::getline(header, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      words >> format;
+      is_binary_little_endian = format == "binary_little_endian";
+    } else if (keyword == "element") {
+      Ply_Element element;
+      words >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) {
+        return 0;
+      }
+      Ply_Property property;
+      std::string type;
+      words >> type;
+      if (type == "list") {
+        property.is_list = true;
+        std::string count_type;
+        words >> count_type >> type;
+        if (!parse_ply_type(count_type, property.count_type)) {
+          return 0;
+        }
+      }
+      if (!parse_ply_type(type, property.type)) {
+        return 0;
+      }
+      words >> property.name;
+      elements.back().properties.push_back(property);
+    }
+  }
+  if (!is_binary_little_endian) {
+    return 0;
+  }
+  return header_end + sizeof(end_header) - 1;
+}
+
+// Skips one property of a row, returns nullptr if it does not fit before end.
+const char *skip_ply_property(const Ply_Property &property, const char *p,
+                              const char *end) {
+  if (!p) {
+    return nullptr;
+  }
+  size_t size = ply_type_size(property.type);
+  if (property.is_list) {
+    size_t count_size = ply_type_size(property.count_type);
+    if (size_t(end - p) < count_size) {
+      return nullptr;
+    }
+    // Also rejects negative and NaN counts before they are cast
+    double count = read_ply_scalar(p, property.count_type);
+    if (!(count >= 0 &&
+          count <= double(size_t(end - p) - count_size) / double(size))) {
+      return nullptr;
+    }
+    size = count_size + size_t(count) * size;
+  }
+  return size_t(end - p) < size ? nullptr : p + size;
+}
+
+const char *skip_ply_row(const Ply_Element &element, const char *p,
+                         const char *end) {
+  for (const auto &property : element.properties) {
+    p = skip_ply_property(property, p, end);
+  }
+  return p;
+}
+
+const char *read_ply_vertices(const Ply_Element &element, const char *p,
+                              const char *end,
+                              std::vector<Vec3<double>> &vertices) {
+  size_t offsets[3] = {0, 0, 0};
+  Ply_Type types[3] = {Ply_Type::F64, Ply_Type::F64, Ply_Type::F64};
+  const char *axis_names[3] = {"x", "y", "z"};
+  int num_found = 0;
+  size_t offset = 0;
+  for (const auto &property : element.properties) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (!property.is_list && property.name == axis_names[axis]) {
+        offsets[axis] = offset;
+        types[axis] = property.type;
+        num_found++;
+      }
+    }
+    offset += ply_type_size(property.type);
+  }
+  if (num_found != 3 || !element.fits(element.min_row_size(), p, end)) {
+    return nullptr;
+  }
+  vertices.assign(element.count, Vec3<double>(0, 0, 0));
+
+  if (!element.has_lists()) {
+    const size_t stride = element.stride();
+    parallel_for(element.count, [&](size_t i) {
+      const char *row = p + i * stride;
+      for (int axis = 0; axis < 3; axis++) {
+        vertices[i][axis] = read_ply_scalar(row + offsets[axis], types[axis]);
+      }
+    });
+    return p + element.count * stride;
+  }
+
+  // Offsets are only valid up to the first list, so walk the properties
+  for (size_t i = 0; i < element.count; i++) {
+    for (const auto &property : element.properties) {
+      const char *next = skip_ply_property(property, p, end);
+      if (!next) {
+        return nullptr;
+      }
+      for (int axis = 0; axis < 3; axis++) {
+        if (!property.is_list && property.name == axis_names[axis]) {
+          vertices[i][axis] = read_ply_scalar(p, property.type);
+        }
+      }
+      p = next;
+    }
+  }
+  return p;
+}
+
+const char *read_ply_faces(const Ply_Element &element, const char *p,
+                           const char *end,
+                           std::vector<std::array<uint32_t, 3>> &tris) {
+  size_t indices_property = element.properties.size();
+  for (size_t i = 0; i < element.properties.size(); i++) {
+    const auto &property = element.properties[i];
+    if (property.is_list && (property.name == "vertex_indices" ||
+                             property.name == "vertex_index")) {
+      indices_property = i;
+    }
+  }
+  if (indices_property == element.properties.size()) {
+    return nullptr;
+  }
+  const auto &indices = element.properties[indices_property];
+  const size_t count_size = ply_type_size(indices.count_type);
+  const size_t index_size = ply_type_size(indices.type);
+
+  // Fast path for faces that only hold triangles with 32 bit indices, they
+  // have a fixed stride and can be decoded in parallel.
+  const size_t tri_stride = count_size + 3 * index_size;
+  if (element.properties.size() == 1 && index_size == 4 &&
+      element.fits(tri_stride, p, end)) {
+    constexpr size_t block_size = 1 << 16;
+    std::vector<uint8_t> block_is_tris((element.count + block_size - 1) /
+                                           block_size,
+                                       1);
+    parallel_for_blocks(element.count, block_size,
+                        [&](size_t block, size_t begin, size_t end) {
+                          for (size_t i = begin; i < end; i++) {
+                            if (read_ply_scalar(p + i * tri_stride,
+                                                indices.count_type) != 3) {
+                              block_is_tris[block] = 0;
+                              return;
+                            }
+                          }
+                        });
+    if (std::all_of(block_is_tris.begin(), block_is_tris.end(),
+                    [](uint8_t is_tris) { return is_tris; })) {
+      tris.resize(element.count);
+      parallel_for(element.count, [&](size_t i) {
+        std::memcpy(tris[i].data(), p + i * tri_stride + count_size,
+                    sizeof(uint32_t[3]));
+      });
+      return p + element.count * tri_stride;
+    }
+  }
+
+  if (!element.fits(element.min_row_size(), p, end)) {
+    return nullptr;
+  }
+  tris.clear();
+  tris.reserve(element.count);
+  std::vector<uint32_t> face;
+  for (size_t i = 0; i < element.count; i++) {
+    for (size_t j = 0; j < element.properties.size(); j++) {
+      const auto &property = element.properties[j];
+      const char *next = skip_ply_property(property, p, end);
+      if (!next) {
+        return nullptr;
+      }
+      if (j == indices_property) {
+        size_t count = size_t(read_ply_scalar(p, property.count_type));
+        face.resize(count);
+        for (size_t k = 0; k < count; k++) {
+          double index =
+              read_ply_scalar(p + count_size + k * index_size, property.type);
+          if (!(index >= 0 && index <= double(UINT32_MAX))) {
+            return nullptr;
+          }
+          face[k] = uint32_t(index);
+        }
+        for (size_t k = 2; k < count; k++) {
+          tris.push_back({face[0], face[k - 1], face[k]});
+        }
+      }
+      p = next;
+    }
+  }
+  return p;
+}
+
+} // namespace
+
+bool read_ply_mesh(const char *path, Indexed_Tri_Mesh<double> &mesh) {
+  mesh = Indexed_Tri_Mesh<double>();
+  Mapped_File file(path);
+  if (!file.is_open) {
+    return false;
+  }
+  std::vector<Ply_Element> elements;
+  size_t data_offset = parse_ply_header(file.data, file.size, elements);
+  if (data_offset == 0) {
+    return false;
+  }
+  const char *p = file.data + data_offset;
+  const char *end = file.data + file.size;
+  bool has_vertices = false;
+  for (const auto &element : elements) {
+    if (element.name == "vertex") {
+      p = read_ply_vertices(element, p, end, mesh.vertices);
+      has_vertices = true;
+    } else if (element.name == "face") {
+      p = read_ply_faces(element, p, end, mesh.tris);
+    } else if (!element.has_lists()) {
+      if (!element.fits(element.stride(), p, end)) {
+        return false;
+      }
+      p += element.count * element.stride();
+    } else {
+      for (size_t i = 0; i < element.count && p; i++) {
+        p = skip_ply_row(element, p, end);
+      }
+    }
+    if (!p) {
+      mesh = Indexed_Tri_Mesh<double>();
+      return false;
+    }
+  }
+  for (const auto &t : mesh.tris) {
+    for (auto vi : t) {
+      if (vi >= mesh.vertices.size()) {
+        mesh = Indexed_Tri_Mesh<double>();
+        return false;
+      }
+    }
+  }
+  return has_vertices;
+}
+
+void write_ply_mesh(const char *path, const Indexed_Tri_Mesh<double> &mesh,
+                    Ply_Precision precision) {
+  assert(precision != Ply_Precision::Quantized16);
+  Ply_Points_Format vertex_format;
+  vertex_format.precision = precision;
+  std::string face_element = "element face " +
+                             std::to_string(mesh.tris.size()) +
+                             "\nproperty list uchar uint vertex_indices\n";
+  Ply_Points_Writer writer(path, mesh.vertices.size(), vertex_format,
+                           face_element.c_str());
+  writer.write(mesh.vertices.data(), mesh.vertices.size());
+
+  constexpr size_t tri_stride = 1 + sizeof(uint32_t[3]);
+  constexpr size_t tris_per_batch = 1 << 16;
+  std::vector<char> buf(tri_stride *
+                        std::min(mesh.tris.size(), tris_per_batch));
+  for (size_t begin = 0; begin < mesh.tris.size(); begin += tris_per_batch) {
+    size_t end = std::min(mesh.tris.size(), begin + tris_per_batch);
+    for (size_t i = begin; i < end; i++) {
+      char *row = buf.data() + (i - begin) * tri_stride;
+      row[0] = 3;
+      std::memcpy(row + 1, mesh.tris[i].data(), sizeof(uint32_t[3]));
+    }
+    writer.ofs.write(buf.data(), (end - begin) * tri_stride);
+  }
+}
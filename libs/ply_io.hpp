@@ -1,8 +1,78 @@
 #pragma once
 
+#include <cstdint>
+#include <fstream>
 #include <vector>
 
+#include "aabb.hpp"
+#include "indexed_tri_mesh.hpp"
+#include "point_cloud.hpp"
 #include "vec3.hpp"
 
+enum class Ply_Layout {
+  // One vertex element holding all properties of a point
+  Interleaved,
+  // One element per attribute, each stored as a contiguous array
+  Separate_Elements,
+};
+
+enum class Ply_Precision {
+  Float64,
+  Float32,
+  // Unsigned 16 bit coordinates relative to the bounds, the header holds
+  // "comment quantization offset ox oy oz" and
+  // "comment quantization scale sx sy sz", so that x = ox + sx * qx.
+  Quantized16,
+};
+
+struct Ply_Points_Format {
+  uint32_t attributes = 0;
+  Ply_Layout layout = Ply_Layout::Interleaved;
+  Ply_Precision precision = Ply_Precision::Float64;
+  // Only used by quantized formats, points must lie within the bounds.
+  AABB<double> bounds;
+};
+
+// Writes a binary point cloud whose size is known up front in batches, so the
+// points never have to be held in memory as a whole. Attributes are packed
+// into a buffer and written in a single pass over every batch.
+struct Ply_Points_Writer {
+  std::ofstream ofs;
+  size_t num_points;
+  Ply_Points_Format format;
+  size_t num_written = 0;
+  std::streamoff data_offset = 0;
+  std::vector<char> buf;
+  std::vector<char> position_buf;
+
+  // trailing_elements holds header lines of elements written after the
+  // points by the caller.
+  Ply_Points_Writer(const char *path, size_t num_points,
+                    const Ply_Points_Format &format = Ply_Points_Format(),
+                    const char *trailing_elements = "");
+  // Writes points only, the format must not have attributes.
+  void write(const Vec3<double> *points, size_t num_points);
+  // The cloud must hold every attribute of the format.
+  void write(const Point_Cloud &cloud);
+
+private:
+  void write(const Point_Cloud *cloud, const Vec3<double> *points,
+             size_t count);
+  const char *convert_positions(const Vec3<double> *points, size_t count);
+};
+
+AABB<double> calc_points_bounds(const std::vector<Vec3<double>> &points);
+
 void write_points_to_ply(const char *path,
-                         const std::vector<Vec3<double>> &points);
\ No newline at end of file
+                         const std::vector<Vec3<double>> &points);
+// Quantized formats get the bounds of the cloud if format.bounds is empty.
+void write_points_to_ply(const char *path, const Point_Cloud &cloud,
+                         Ply_Points_Format format = Ply_Points_Format());
+
+// Reads a binary little endian PLY mesh through a memory mapping. Faces
+// stored as fixed size triangle lists are decoded in parallel, other polygons
+// are triangulated as fans. Returns false on unsupported or truncated files.
+bool read_ply_mesh(const char *path, Indexed_Tri_Mesh<double> &mesh);
+// Quantized precisions are not supported for meshes.
+void write_ply_mesh(const char *path, const Indexed_Tri_Mesh<double> &mesh,
+                    Ply_Precision precision = Ply_Precision::Float64);
\ No newline at end of file
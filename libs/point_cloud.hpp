@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "vec3.hpp"
+
+// Optional per-point attributes, combined as bit flags
+enum Point_Attribute : uint32_t {
+  Point_Normal = 1 << 0,
+  Point_Tri_Index = 1 << 1,
+  // Weights of the second and third triangle vertex
+  Point_Barycentric = 1 << 2,
+  Point_Color = 1 << 3,
+};
+
+// Points with optional attributes stored as separate arrays, an attribute
+// array is either empty or has one entry per point.
+struct Point_Cloud {
+  std::vector<Vec3<double>> points;
+  std::vector<Vec3<float>> normals;
+  std::vector<uint32_t> tri_indices;
+  std::vector<std::array<float, 2>> barycentrics;
+  std::vector<std::array<uint8_t, 3>> colors;
+
+  size_t size() const { return points.size(); }
+
+  uint32_t attributes() const {
+    uint32_t result = 0;
+    result |= normals.empty() ? 0 : uint32_t(Point_Normal);
+    result |= tri_indices.empty() ? 0 : uint32_t(Point_Tri_Index);
+    result |= barycentrics.empty() ? 0 : uint32_t(Point_Barycentric);
+    result |= colors.empty() ? 0 : uint32_t(Point_Color);
+    return result;
+  }
+};
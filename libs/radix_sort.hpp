@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Stable LSD radix sort of items by get_key(item), which must return an
+// unsigned integer. Only the bits that differ between keys are sorted, in
+// passes of at most 11 bits, so small keys take few passes. Every pass counts
+// digits per block of items and scatters the blocks in parallel, block
+// boundaries do not depend on the number of threads.
+template <typename Item, typename Get_Key>
+void radix_sort(std::vector<Item> &items, Get_Key &&get_key) {
+  using Key = decltype(get_key(items[0]));
+  constexpr size_t block_size = 1 << 16;
+  constexpr int max_digit_bits = 11;
+  const size_t n = items.size();
+  if (n < 2) {
+    return;
+  }
+  const size_t num_blocks = (n + block_size - 1) / block_size;
+
+  // Bits that differ from the first key in any key
+  std::vector<Key> block_diffs(num_blocks, Key(0));
+  const Key first_key = get_key(items[0]);
+  parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                         size_t end) {
+    Key diff = 0;
+    for (size_t i = begin; i < end; i++) {
+      diff |= get_key(items[i]) ^ first_key;
+    }
+    block_diffs[block] = diff;
+  });
+  Key diff = 0;
+  for (auto d : block_diffs) {
+    diff |= d;
+  }
+  if (diff == 0) {
+    return;
+  }
+  int first_bit = 0;
+  while (!((diff >> first_bit) & 1)) {
+    first_bit++;
+  }
+  int last_bit = sizeof(Key) * 8;
+  while (!((diff >> (last_bit - 1)) & 1)) {
+    last_bit--;
+  }
+  const int num_bits = last_bit - first_bit;
+  const int num_passes = (num_bits + max_digit_bits - 1) / max_digit_bits;
+  const int digit_bits = (num_bits + num_passes - 1) / num_passes;
+  const size_t num_digits = size_t(1) << digit_bits;
+
+  std::vector<Item> scratch(n);
+  std::vector<size_t> offsets(num_blocks * num_digits);
+  for (int shift = first_bit; shift < last_bit; shift += digit_bits) {
+    auto get_digit = [&](const Item &item) {
+      return size_t(get_key(item) >> shift) & (num_digits - 1);
+    };
+    parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                           size_t end) {
+      size_t *counts = offsets.data() + block * num_digits;
+      std::fill(counts, counts + num_digits, 0);
+      for (size_t i = begin; i < end; i++) {
+        counts[get_digit(items[i])]++;
+      }
+    });
+    // Digit major, block minor, which keeps equal digits in input order
+    size_t sum = 0;
+    for (size_t digit = 0; digit < num_digits; digit++) {
+      for (size_t block = 0; block < num_blocks; block++) {
+        size_t &offset = offsets[block * num_digits + digit];
+        size_t count = offset;
+        offset = sum;
+        sum += count;
+      }
+    }
+    parallel_for_blocks(n, block_size, [&](size_t block, size_t begin,
+                                           size_t end) {
+      size_t *cursors = offsets.data() + block * num_digits;
+      for (size_t i = begin; i < end; i++) {
+        scratch[cursors[get_digit(items[i])]++] = items[i];
+      }
+    });
+    items.swap(scratch);
+  }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "indexed_tri_mesh.hpp"
+#include "mesh_adjacency.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+
+enum class Smoothing_Scheme {
+  // Every neighbour counts the same
+  Uniform,
+  // Uniform steps alternating between lambda and mu, which avoids shrinking
+  Taubin,
+  // Neighbours are weighted by the cotangents of the angles opposite their
+  // edge
+  Cotangent,
+};
+
+struct Smoothing_Params {
+  Smoothing_Scheme scheme = Smoothing_Scheme::Uniform;
+  size_t num_iters = 1;
+  // Step towards the weighted mean of the neighbours, 1 moves every vertex
+  // onto the mean
+  double lambda = 1.0;
+  // Second, negative step of every Taubin iteration
+  double mu = -0.53;
+};
+
+// Cotangent weight of every entry of the vertex-vertex adjacency. Weights
+// are clamped at zero, so obtuse triangles cannot flip a vertex across its
+// neighbours.
+template <typename T>
+std::vector<T> calc_cotangent_weights(const std::vector<Vec3<T>> &vertices,
+                                      const Tri_List &tris,
+                                      const Csr_Adjacency &vertex_vertex) {
+  auto vertex_corners = build_vertex_corner_adjacency(tris, vertices.size());
+  std::vector<T> weights(vertex_vertex.indices.size(), T(0));
+  auto calc_cotangent = [&](uint32_t apex, uint32_t a, uint32_t b) {
+    auto e1 = vertices[a] - vertices[apex];
+    auto e2 = vertices[b] - vertices[apex];
+    T sine = e1.cross(e2).length();
+    return sine > 0 ? e1.dot(e2) / sine : T(0);
+  };
+  parallel_for(vertices.size(), [&](size_t i) {
+    const uint32_t *row = vertex_vertex.indices.data();
+    auto add_weight = [&](uint32_t neighbour, T weight) {
+      const uint32_t *first = row + vertex_vertex.offsets[i];
+      const uint32_t *last = row + vertex_vertex.offsets[i + 1];
+      weights[std::lower_bound(first, last, neighbour) - row] += weight / 2;
+    };
+    for (auto corner : vertex_corners[i]) {
+      const auto &t = tris[corner / 3];
+      uint32_t b = t[(corner + 1) % 3];
+      uint32_t c = t[(corner + 2) % 3];
+      if (b == i || c == i || b == c) {
+        continue;
+      }
+      add_weight(b, calc_cotangent(c, uint32_t(i), b));
+      add_weight(c, calc_cotangent(b, uint32_t(i), c));
+    }
+  });
+  parallel_for(weights.size(),
+               [&](size_t i) { weights[i] = std::max(weights[i], T(0)); });
+  return weights;
+}
+
+// One Jacobi step from in to out. Vertices without neighbours, or whose
+// weights sum to zero, are copied unchanged.
+template <bool is_weighted, typename T>
+void laplacian_step(const Vec3<T> *in, Vec3<T> *out, size_t num_vertices,
+                    const Csr_Adjacency &neighbours, const T *weights,
+                    T factor) {
+  parallel_for(num_vertices, [&](size_t i) {
+    T x = 0, y = 0, z = 0, weight_sum = 0;
+    for (uint32_t k = neighbours.offsets[i]; k < neighbours.offsets[i + 1];
+         k++) {
+      const Vec3<T> &p = in[neighbours.indices[k]];
+      if constexpr (is_weighted) {
+        T w = weights[k];
+        x += w * p.x;
+        y += w * p.y;
+        z += w * p.z;
+        weight_sum += w;
+      } else {
+        x += p.x;
+        y += p.y;
+        z += p.z;
+        weight_sum += 1;
+      }
+    }
+    if (weight_sum == 0) {
+      out[i] = in[i];
+      return;
+    }
+    Vec3<T> mean(x / weight_sum, y / weight_sum, z / weight_sum);
+    out[i] = factor == 1 ? mean : in[i] + (mean - in[i]) * factor;
+  });
+}
+
+// Jacobi iterations between two buffers whose roles are swapped after every
+// step, so iterations neither allocate nor copy.
+// neighbours is the vertex-vertex adjacency of the mesh.
+template <typename T>
+void smooth_mesh(Indexed_Tri_Mesh<T> &mesh, const Smoothing_Params &params,
+                 const Csr_Adjacency &neighbours) {
+  const size_t n = mesh.vertices.size();
+  std::vector<T> weights;
+  if (params.scheme == Smoothing_Scheme::Cotangent) {
+    weights = calc_cotangent_weights(mesh.vertices, mesh.tris, neighbours);
+  }
+  std::vector<T> factors = {T(params.lambda)};
+  if (params.scheme == Smoothing_Scheme::Taubin) {
+    factors.push_back(T(params.mu));
+  }
+
+  std::vector<Vec3<T>> buffer(n, Vec3<T>(0, 0, 0));
+  Vec3<T> *in = mesh.vertices.data();
+  Vec3<T> *out = buffer.data();
+  for (size_t iter = 0; iter < params.num_iters; iter++) {
+    for (T factor : factors) {
+      if (weights.empty()) {
+        laplacian_step<false>(in, out, n, neighbours, weights.data(), factor);
+      } else {
+        laplacian_step<true>(in, out, n, neighbours, weights.data(), factor);
+      }
+      std::swap(in, out);
+    }
+  }
+  if (in != mesh.vertices.data()) {
+    mesh.vertices.swap(buffer);
+  }
+}
+
+template <typename T>
+void smooth_mesh(Indexed_Tri_Mesh<T> &mesh, const Smoothing_Params &params) {
+  smooth_mesh(mesh, params,
+              build_vertex_vertex_adjacency(mesh.tris, mesh.vertices.size()));
+}
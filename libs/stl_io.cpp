@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdint>
@@ -42,38 +43,71 @@ struct File_Buf {
   }
 };
 
-std::vector<Triangle<double>> read_stl(const char *path) {
-  std::vector<Triangle<double>> tris;
-
-  std::ifstream ifs(path, std::ios::binary);
-
+Stl_Reader::Stl_Reader(const char *path) : ifs(path, std::ios::binary) {
   ifs.seekg(80, std::ios::beg);
-  uint32_t num_tris;
   ifs.read(reinterpret_cast<char *>(&num_tris), sizeof(uint32_t));
 
   uint64_t expected_size = 50 * uint64_t(num_tris) + 84;
 
   ifs.seekg(0, std::ios::end);
   auto file_size = ifs.tellg();
+  is_binary = ifs && uint64_t(file_size) == expected_size;
+  rewind();
+}
 
-  if (file_size == expected_size) {
-    ifs.seekg(84, std::ios::beg);
-    tris.reserve(num_tris);
-    for (uint32_t i = 0; i < num_tris; i++) {
+void Stl_Reader::rewind() {
+  ifs.clear();
+  ifs.seekg(84, std::ios::beg);
+}
+
+size_t Stl_Reader::read_tris(std::vector<Triangle<double>> &tris,
+                             size_t max_tris,
+                             std::vector<uint16_t> *attributes) {
+  constexpr size_t tri_size = 50;
+  constexpr size_t max_batch_tris = 1 << 14;
+  buf.resize(tri_size * max_batch_tris);
+  size_t num_read = 0;
+  while (num_read < max_tris) {
+    size_t batch_tris = std::min(max_batch_tris, max_tris - num_read);
+    ifs.read(buf.data(), tri_size * batch_tris);
+    batch_tris = size_t(ifs.gcount()) / tri_size;
+    for (size_t i = 0; i < batch_tris; i++) {
+      // Skip the normal, the attribute byte count follows the vertices
+      const char *tri_buf = buf.data() + i * tri_size + sizeof(float[3]);
       Triangle<double> t = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-      float normal[3];
-      ifs.read(reinterpret_cast<char *>(normal), sizeof(float[3]));
       for (int j = 0; j < 3; j++) {
-        float buf[3];
-        ifs.read(reinterpret_cast<char *>(buf), sizeof(float[3]));
-        t[j] = Vec3<float>(buf).as<double>();
+        float v[3];
+        std::memcpy(v, tri_buf + j * sizeof(float[3]), sizeof(float[3]));
+        t[j] = Vec3<float>(v).as<double>();
       }
-      uint16_t attribute_byte_count;
-      ifs.read(reinterpret_cast<char *>(&attribute_byte_count),
-               sizeof(uint16_t));
       tris.push_back(t);
+      if (attributes) {
+        uint16_t attribute_byte_count;
+        std::memcpy(&attribute_byte_count, tri_buf + sizeof(float[9]),
+                    sizeof(uint16_t));
+        attributes->push_back(attribute_byte_count);
+      }
     }
+    num_read += batch_tris;
+    if (!ifs) {
+      break;
+    }
+  }
+  return num_read;
+}
+
+std::vector<Triangle<double>> read_stl(const char *path,
+                                       std::vector<uint16_t> *attributes) {
+  std::vector<Triangle<double>> tris;
+
+  Stl_Reader reader(path);
+  if (reader.is_binary) {
+    tris.reserve(reader.num_tris);
+    reader.read_tris(tris, reader.num_tris, attributes);
   } else {
+    std::ifstream ifs(path, std::ios::binary);
+    ifs.seekg(0, std::ios::end);
+    auto file_size = ifs.tellg();
     ifs.seekg(0, std::ios::beg);
 
     char *buf = (char *)malloc(file_size);
@@ -105,28 +139,43 @@ std::vector<Triangle<double>> read_stl(const char *path) {
     }
 
     free(buf);
+    if (attributes) {
+      attributes->resize(attributes->size() + tris.size(), 0);
+    }
   }
 
   return tris;
 }
 
-void write_stl_binary(const char *path,
-                      const std::vector<Triangle<double>> &tris) {
+Stl_Writer::Stl_Writer(const char *path, uint32_t num_tris)
+    : ofs(path, std::ios::binary | std::ios::trunc) {
   char header[80] = {};
-  uint32_t num_tris = (uint32_t)tris.size();
-  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
   ofs.write(header, 80);
   ofs.write(reinterpret_cast<const char *>(&num_tris), sizeof(uint32_t));
-  for (const auto &t : tris) {
-    float normal[3] = {0, 0, 0};
-    ofs.write(reinterpret_cast<const char *>(normal), sizeof(float[3]));
+}
+
+void Stl_Writer::write_tris(const Triangle<double> *tris, size_t num_tris) {
+  constexpr size_t tri_size = 50;
+  buf.assign(tri_size * num_tris, 0);
+  for (size_t i = 0; i < num_tris; i++) {
+    // The normal is left zero and so is the attribute byte count
+    char *tri_buf = buf.data() + i * tri_size + sizeof(float[3]);
     for (int j = 0; j < 3; j++) {
-      float buf[3] = {float(t[j].x), float(t[j].y), float(t[j].z)};
-      ofs.write(reinterpret_cast<const char *>(buf), sizeof(float[3]));
+      const auto &v = tris[i][j];
+      float p[3] = {float(v.x), float(v.y), float(v.z)};
+      std::memcpy(tri_buf + j * sizeof(float[3]), p, sizeof(float[3]));
     }
-    uint16_t attribute_byte_count = 0;
-    ofs.write(reinterpret_cast<const char *>(&attribute_byte_count),
-              sizeof(uint16_t));
+  }
+  ofs.write(buf.data(), buf.size());
+}
+
+void write_stl_binary(const char *path,
+                      const std::vector<Triangle<double>> &tris) {
+  Stl_Writer writer(path, uint32_t(tris.size()));
+  constexpr size_t max_batch_tris = 1 << 14;
+  for (size_t i = 0; i < tris.size(); i += max_batch_tris) {
+    writer.write_tris(tris.data() + i,
+                      std::min(max_batch_tris, tris.size() - i));
   }
 }
 
@@ -1,10 +1,56 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <fstream>
 #include <vector>
 
 #include "triangle.hpp"
 
-std::vector<Triangle<double>> read_stl(const char *path);
+// Reads a binary STL file in batches of triangles, so it never has to be held
+// in memory as a whole.
+struct Stl_Reader {
+  std::ifstream ifs;
+  uint32_t num_tris = 0;
+  bool is_binary = false;
+  std::vector<char> buf;
+
+  explicit Stl_Reader(const char *path);
+  // Appends up to max_tris triangles to tris and returns how many were read.
+  // The attribute byte count of every triangle is appended to attributes if
+  // given.
+  size_t read_tris(std::vector<Triangle<double>> &tris, size_t max_tris,
+                   std::vector<uint16_t> *attributes = nullptr);
+  // Seeks back to the first triangle.
+  void rewind();
+};
+
+// The attribute byte counts of binary files are appended to attributes if
+// given, ASCII files have none and get zeros.
+std::vector<Triangle<double>>
+read_stl(const char *path, std::vector<uint16_t> *attributes = nullptr);
+
+// Decodes the VisCAM/SolidView colour stored in the attribute byte count, bits
+// 0-4, 5-9 and 10-14 hold blue, green and red and bit 15 marks a valid colour.
+// Triangles without a valid colour are white.
+inline std::array<uint8_t, 3> stl_attribute_to_color(uint16_t attribute) {
+  if (!(attribute & 0x8000)) {
+    return {255, 255, 255};
+  }
+  auto expand = [](uint16_t c) { return uint8_t((c & 31) * 255 / 31); };
+  return {expand(attribute >> 10), expand(attribute >> 5), expand(attribute)};
+}
+
+// Writes a binary STL file in batches of triangles, the number of triangles
+// has to be known up front.
+struct Stl_Writer {
+  std::ofstream ofs;
+  std::vector<char> buf;
+
+  Stl_Writer(const char *path, uint32_t num_tris);
+  void write_tris(const Triangle<double> *tris, size_t num_tris);
+};
+
 void write_stl_binary(const char *path,
                       const std::vector<Triangle<double>> &tris);
 void write_stl_ascii(const char *path,
@@ -0,0 +1,561 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "half_edge_mesh.hpp"
+#include "indexed_tri_mesh.hpp"
+#include "parallel.hpp"
+#include "triangle.hpp"
+#include "vec3.hpp"
+
+// Every level splits each triangle into four through its edge midpoints. The
+// connectivity of the next level is derived from the half-edges of the
+// current one, so edges are only extracted once for the input mesh.
+//
+// Triangle t with corners v0, v1, v2 and edge vertices m0, m1, m2 on the
+// edges starting at those corners becomes triangles 4t to 4t + 3:
+// {m0, m1, m2}, {v0, m0, m2}, {v1, m1, m0} and {v2, m2, m1}. Edge vertex i
+// of the next level is vertex num_vertices + i, and edge e is split into
+// edges 2e, starting at the origin of its first half-edge, and 2e + 1.
+// Triangle t adds edges 2 * num_edges + 3t + j from m_j to m_j+1.
+
+enum class Subdivision_Scheme {
+  // Edge vertices at edge midpoints, vertices do not move
+  Midpoint,
+  // Charles Loop's approximating scheme for smooth surfaces
+  Loop,
+  // Dyn, Levin and Gregory's interpolating butterfly scheme, vertices do not
+  // move so it also works on partially refined meshes
+  Butterfly,
+};
+
+// Position of the vertex inserted on the edge of half-edge h. Edges whose
+// stencil runs into a boundary or non-manifold edge get midpoints.
+template <typename T>
+Vec3<T> calc_edge_vertex(const Half_Edge_Mesh<T> &mesh, uint32_t h,
+                         Subdivision_Scheme scheme) {
+  const auto &p = mesh.vertices;
+  const auto &a = p[mesh.origin(h)];
+  const auto &b = p[mesh.target(h)];
+  if (scheme == Subdivision_Scheme::Midpoint || !mesh.has_twin(h)) {
+    return (a + b) / T(2);
+  }
+  uint32_t twin = mesh.twins[h];
+  const auto &c = p[mesh.origin(mesh.prev(h))];
+  const auto &d = p[mesh.origin(mesh.prev(twin))];
+  if (scheme == Subdivision_Scheme::Loop) {
+    return (a + b) * T(3.0 / 8.0) + (c + d) * T(1.0 / 8.0);
+  }
+  // Vertices across the other edges of both triangles
+  Vec3<T> wings(0, 0, 0);
+  for (auto w :
+       {mesh.next(h), mesh.prev(h), mesh.next(twin), mesh.prev(twin)}) {
+    if (!mesh.has_twin(w)) {
+      return (a + b) / T(2);
+    }
+    wings += p[mesh.origin(mesh.prev(mesh.twins[w]))];
+  }
+  return (a + b) * T(1.0 / 2.0) + (c + d) * T(1.0 / 8.0) -
+         wings * T(1.0 / 16.0);
+}
+
+// Vertex k of child triangle c of triangle t
+template <typename T>
+uint32_t get_child_tri_vertex(const Half_Edge_Mesh<T> &mesh, uint32_t t,
+                              int c, int k) {
+  uint32_t num_vertices = uint32_t(mesh.vertices.size());
+  auto edge_vertex = [&](int corner) {
+    return num_vertices + mesh.half_edge_edges[t * 3 + corner];
+  };
+  if (c == 0) {
+    return edge_vertex(k);
+  }
+  int corner = c - 1;
+  switch (k) {
+  case 0:
+    return mesh.half_edge_vertices[t * 3 + corner];
+  case 1:
+    return edge_vertex(corner);
+  default:
+    return edge_vertex((corner + 2) % 3);
+  }
+}
+
+template <typename T>
+std::array<uint32_t, 3> get_child_tri(const Half_Edge_Mesh<T> &mesh,
+                                      uint32_t t, int c) {
+  return {get_child_tri_vertex(mesh, t, c, 0),
+          get_child_tri_vertex(mesh, t, c, 1),
+          get_child_tri_vertex(mesh, t, c, 2)};
+}
+
+// Positions of the next level, the vertices of the mesh followed by one
+// vertex per edge. Non-manifold vertices keep their position under Loop.
+template <typename T>
+void calc_subdivided_vertices(const Half_Edge_Mesh<T> &mesh,
+                              Subdivision_Scheme scheme, Vec3<T> *out) {
+  const size_t num_vertices = mesh.vertices.size();
+  const auto &p = mesh.vertices;
+  parallel_for(mesh.num_edges(), [&](size_t i) {
+    out[num_vertices + i] = calc_edge_vertex(mesh, mesh.edges[i], scheme);
+  });
+  if (scheme != Subdivision_Scheme::Loop) {
+    parallel_for(num_vertices, [&](size_t i) { out[i] = p[i]; });
+    return;
+  }
+
+  constexpr double pi = 3.14159265358979323846;
+  // Vertices with more outgoing half-edges than their rotation has are
+  // non-manifold
+  std::vector<std::atomic<uint32_t>> valences(num_vertices);
+  parallel_for(num_vertices, [&](size_t i) {
+    valences[i].store(0, std::memory_order_relaxed);
+  });
+  parallel_for(mesh.half_edge_vertices.size(), [&](size_t i) {
+    valences[mesh.half_edge_vertices[i]].fetch_add(1,
+                                                  std::memory_order_relaxed);
+  });
+  parallel_for(num_vertices, [&](size_t i) {
+    uint32_t v = uint32_t(i);
+    uint32_t n = 0;
+    uint32_t last = no_half_edge;
+    Vec3<T> sum(0, 0, 0);
+    mesh.for_each_outgoing(v, [&](uint32_t h) {
+      sum += p[mesh.target(h)];
+      last = h;
+      n++;
+    });
+    if (n == 0 || n != valences[i].load(std::memory_order_relaxed)) {
+      out[i] = p[i];
+    } else if (mesh.is_boundary_vertex(v)) {
+      const auto &b0 = p[mesh.target(mesh.vertex_half_edges[v])];
+      const auto &b1 = p[mesh.origin(mesh.prev(last))];
+      out[i] = p[i] * T(3.0 / 4.0) + (b0 + b1) * T(1.0 / 8.0);
+    } else {
+      T w = T(3.0 / 8.0) + std::cos(T(2 * pi) / n) / T(4);
+      T beta = (T(5.0 / 8.0) - w * w) / n;
+      out[i] = p[i] * (1 - n * beta) + sum * beta;
+    }
+  });
+}
+
+// One level of subdivision from mesh into out, reusing the capacity of out.
+template <typename T>
+void subdivide_half_edge_mesh(const Half_Edge_Mesh<T> &mesh,
+                              Subdivision_Scheme scheme,
+                              Half_Edge_Mesh<T> &out) {
+  const size_t num_vertices = mesh.vertices.size();
+  const size_t num_edges = mesh.num_edges();
+  const size_t num_faces = mesh.num_faces();
+  out.vertices.resize(num_vertices + num_edges, Vec3<T>(0, 0, 0));
+  calc_subdivided_vertices(mesh, scheme, out.vertices.data());
+  out.half_edge_vertices.resize(num_faces * 12);
+  out.twins.resize(num_faces * 12);
+  out.half_edge_edges.resize(num_faces * 12);
+  out.edges.resize(num_edges * 2 + num_faces * 3);
+  out.vertex_half_edges.resize(num_vertices + num_edges);
+
+  // Child half-edges along half-edge h, from its origin to the edge vertex
+  // and from the edge vertex to its target
+  auto first_half = [](uint32_t h) { return (h / 3) * 12 + 3 + h % 3 * 3; };
+  auto second_half = [](uint32_t h) {
+    return (h / 3) * 12 + 3 + (h + 1) % 3 * 3 + 2;
+  };
+  parallel_for(num_faces, [&](size_t i) {
+    uint32_t t = uint32_t(i);
+    for (int c = 0; c < 4; c++) {
+      for (int k = 0; k < 3; k++) {
+        out.half_edge_vertices[t * 12 + c * 3 + k] =
+            get_child_tri_vertex(mesh, t, c, k);
+      }
+    }
+    for (int j = 0; j < 3; j++) {
+      uint32_t h = t * 3 + j;
+      uint32_t edge = mesh.half_edge_edges[h];
+      bool is_forward = mesh.origin(h) == mesh.origin(mesh.edges[edge]);
+      out.half_edge_edges[first_half(h)] = edge * 2 + !is_forward;
+      out.half_edge_edges[second_half(h)] = edge * 2 + is_forward;
+      uint32_t twin = mesh.twins[h];
+      if (mesh.has_twin(h)) {
+        out.twins[first_half(h)] = second_half(twin);
+        out.twins[second_half(h)] = first_half(twin);
+      } else {
+        out.twins[first_half(h)] = twin;
+        out.twins[second_half(h)] = twin;
+      }
+
+      // Inner edge from m_j to m_j+1 and its twin in the corner triangle
+      uint32_t inner = t * 12 + j;
+      uint32_t inner_twin = t * 12 + 3 + (j + 1) % 3 * 3 + 1;
+      uint32_t inner_edge = uint32_t(num_edges * 2 + t * 3 + j);
+      out.twins[inner] = inner_twin;
+      out.twins[inner_twin] = inner;
+      out.half_edge_edges[inner] = inner_edge;
+      out.half_edge_edges[inner_twin] = inner_edge;
+      out.edges[inner_edge] = inner;
+    }
+  });
+  parallel_for(num_edges, [&](size_t i) {
+    uint32_t h = mesh.edges[i];
+    out.edges[i * 2] = first_half(h);
+    out.edges[i * 2 + 1] = second_half(h);
+    // Starts without a twin on boundary edges
+    out.vertex_half_edges[num_vertices + i] = second_half(h);
+  });
+  parallel_for(num_vertices, [&](size_t i) {
+    uint32_t h = mesh.vertex_half_edges[i];
+    out.vertex_half_edges[i] = h == no_half_edge ? h : first_half(h);
+  });
+}
+
+// Element counts of a mesh, 64 bit so the counts of later levels can be
+// checked before they are built
+struct Subdivision_Counts {
+  uint64_t num_vertices;
+  uint64_t num_edges;
+  uint64_t num_faces;
+
+  // Counts one level later, every scheme adds a vertex per edge and splits
+  // every face into four
+  Subdivision_Counts subdivided() const {
+    return {num_vertices + num_edges, num_edges * 2 + num_faces * 3,
+            num_faces * 4};
+  }
+};
+
+// Counts after num_levels levels, which can wrap for levels that
+// can_subdivide_half_edge_mesh rejects
+template <typename T>
+Subdivision_Counts get_subdivided_counts(const Half_Edge_Mesh<T> &mesh,
+                                         size_t num_levels) {
+  Subdivision_Counts counts = {mesh.vertices.size(), mesh.num_edges(),
+                               mesh.num_faces()};
+  for (size_t level = 0; level < num_levels; level++) {
+    counts = counts.subdivided();
+  }
+  return counts;
+}
+
+// Whether building num_levels levels keeps the half-edge, edge and vertex
+// indices of every level below no_half_edge. Stops at the first level that
+// does not, so counts cannot wrap and any number of levels can be checked.
+template <typename T>
+bool can_subdivide_half_edge_mesh(const Half_Edge_Mesh<T> &mesh,
+                                  size_t num_levels) {
+  Subdivision_Counts counts = get_subdivided_counts(mesh, 0);
+  for (size_t level = 0; level < num_levels; level++) {
+    counts = counts.subdivided();
+    if (counts.num_faces * 3 >= no_half_edge ||
+        counts.num_edges >= no_half_edge ||
+        counts.num_vertices >= no_half_edge) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Subdivides mesh num_levels times, which can_subdivide_half_edge_mesh must
+// allow. Every level has the same element counts whatever the scheme, so both
+// buffers are allocated for the largest level up front.
+template <typename T>
+void subdivide_half_edge_mesh(Half_Edge_Mesh<T> &mesh, size_t num_levels,
+                              Subdivision_Scheme scheme) {
+  if (num_levels == 0) {
+    return;
+  }
+  const auto counts = get_subdivided_counts(mesh, num_levels);
+  const size_t num_vertices = counts.num_vertices;
+  const size_t num_edges = counts.num_edges;
+  const size_t num_faces = counts.num_faces;
+  Half_Edge_Mesh<T> next;
+  for (auto *m : {&mesh, &next}) {
+    m->vertices.reserve(num_vertices);
+    m->half_edge_vertices.reserve(num_faces * 3);
+    m->twins.reserve(num_faces * 3);
+    m->half_edge_edges.reserve(num_faces * 3);
+    m->edges.reserve(num_edges);
+    m->vertex_half_edges.reserve(num_vertices);
+  }
+  for (size_t level = 0; level < num_levels; level++) {
+    subdivide_half_edge_mesh(mesh, scheme, next);
+    std::swap(mesh, next);
+  }
+}
+
+struct Adaptive_Subdivision_Params {
+  // Edges longer than this are split, 0 disables the criterion
+  double max_edge_length = 0;
+  // Edges whose triangles' normals differ by more than this many radians are
+  // split, 0 disables the criterion
+  double max_normal_angle = 0;
+};
+
+// Triangles out[0] and out[1] are the halves of t bisected from edge c at its
+// midpoint m. Green pairs are always laid out this way, so the first half is
+// {a, m, o} and the second {m, b, o} for the parent {a, b, o}.
+inline void bisect_triangle(const std::array<uint32_t, 3> &t, int c,
+                            uint32_t m, std::array<uint32_t, 3> *out) {
+  uint32_t opposite = t[(c + 2) % 3];
+  out[0] = {t[c], m, opposite};
+  out[1] = {m, t[(c + 1) % 3], opposite};
+}
+
+// One level of red-green refinement, which only splits the edges that exceed
+// a threshold and keeps the mesh conforming. Triangles with two or three
+// split edges are split into four (red), so marks spread until every
+// triangle has zero, one or three of them. Triangles with one split edge are
+// bisected from the opposite corner (green). Marks are atomic, so every
+// round of spreading runs in parallel over the triangles and the result does
+// not depend on the number of threads. Returns the number of split edges.
+//
+// green_pairs holds the triangle indices of the green halves made by the
+// previous level and is replaced by those of this level, it starts empty for
+// a mesh that was not refined yet. Green halves are never split again: a pair
+// with any split edge is replaced by the red split of its parent, whose two
+// halves of the bisected edge are themselves bisected if they are split.
+template <typename T>
+size_t subdivide_adaptive(Indexed_Tri_Mesh<T> &mesh,
+                          std::vector<std::array<uint32_t, 2>> &green_pairs,
+                          Subdivision_Scheme scheme,
+                          const Adaptive_Subdivision_Params &params) {
+  auto half_edge_mesh = Half_Edge_Mesh<T>::from_indexed_mesh(mesh);
+  const auto &he = half_edge_mesh;
+  const size_t num_vertices = mesh.vertices.size();
+  const size_t num_edges = he.num_edges();
+  const size_t num_tris = mesh.tris.size();
+
+  // Index of the other half and the side, 0 or 1, of every green half
+  constexpr uint8_t no_side = 2;
+  std::vector<uint32_t> partners(num_tris, 0);
+  std::vector<uint8_t> sides(num_tris, no_side);
+  for (const auto &pair : green_pairs) {
+    for (int side = 0; side < 2; side++) {
+      partners[pair[side]] = pair[1 - side];
+      sides[pair[side]] = uint8_t(side);
+    }
+  }
+  // Edges of a green half by side, the half of the bisected edge is always
+  // edge 0
+  auto outer_edge = [](uint8_t side) { return side == 0 ? 2 : 1; };
+  auto inner_edge = [](uint8_t side) { return side == 0 ? 1 : 2; };
+
+  std::vector<Vec3<T>> face_normals;
+  if (params.max_normal_angle > 0) {
+    face_normals.resize(num_tris, Vec3<T>(0, 0, 0));
+    parallel_for(num_tris, [&](size_t i) {
+      const auto &t = mesh.tris[i];
+      auto n = (mesh.vertices[t[1]] - mesh.vertices[t[0]])
+                   .cross(mesh.vertices[t[2]] - mesh.vertices[t[0]]);
+      T length = n.length();
+      face_normals[i] = length > 0 ? n / length : n;
+    });
+  }
+  const T min_cos = T(std::cos(params.max_normal_angle));
+  std::vector<std::atomic<uint8_t>> marks(num_edges);
+  parallel_for(num_edges, [&](size_t i) {
+    uint32_t h = he.edges[i];
+    bool is_split = false;
+    if (params.max_edge_length > 0) {
+      auto e = he.vertices[he.target(h)] - he.vertices[he.origin(h)];
+      is_split = e.length() > T(params.max_edge_length);
+    }
+    if (params.max_normal_angle > 0 && he.has_twin(h)) {
+      T cos = face_normals[he.face(h)].dot(face_normals[he.face(he.twins[h])]);
+      is_split = is_split || cos < min_cos;
+    }
+    marks[i].store(is_split, std::memory_order_relaxed);
+  });
+
+  auto get_edge = [&](size_t ti, int k) {
+    return he.half_edge_edges[ti * 3 + k];
+  };
+  auto is_marked = [&](size_t ti, int k) {
+    return marks[get_edge(ti, k)].load(std::memory_order_relaxed) != 0;
+  };
+  auto count_marks = [&](size_t ti) {
+    int count = 0;
+    for (int k = 0; k < 3; k++) {
+      count += is_marked(ti, k);
+    }
+    return count;
+  };
+  // A green half becomes part of a red parent once its pair has any mark,
+  // which then splits the outer edges of both halves
+  auto is_pair_marked = [&](size_t ti) {
+    return count_marks(ti) + count_marks(partners[ti]) > 0;
+  };
+  std::atomic<bool> is_changed{true};
+  while (is_changed) {
+    is_changed = false;
+    parallel_for(num_tris, [&](size_t i) {
+      if (sides[i] != no_side) {
+        uint32_t outer = get_edge(i, outer_edge(sides[i]));
+        if (!marks[outer].load(std::memory_order_relaxed) &&
+            is_pair_marked(i)) {
+          marks[outer].store(1, std::memory_order_relaxed);
+          is_changed.store(true, std::memory_order_relaxed);
+        }
+      } else if (count_marks(i) == 2) {
+        for (int k = 0; k < 3; k++) {
+          marks[get_edge(i, k)].store(1, std::memory_order_relaxed);
+        }
+        is_changed.store(true, std::memory_order_relaxed);
+      }
+    });
+  }
+  // The edge between the halves of a red parent disappears
+  auto is_red_parent = [&](size_t ti) {
+    return sides[ti] != no_side && is_marked(ti, outer_edge(sides[ti]));
+  };
+  parallel_for(num_tris, [&](size_t i) {
+    if (sides[i] == 0 && is_red_parent(i)) {
+      marks[get_edge(i, inner_edge(0))].store(0, std::memory_order_relaxed);
+    }
+  });
+
+  // Split edges get consecutive vertices after the existing ones
+  std::vector<uint32_t> edge_vertices(num_edges);
+  parallel_for(num_edges, [&](size_t i) {
+    edge_vertices[i] = marks[i].load(std::memory_order_relaxed);
+  });
+  size_t num_split =
+      parallel_exclusive_scan(edge_vertices.data(), edge_vertices.size());
+  if (num_split == 0) {
+    return 0;
+  }
+  mesh.vertices.resize(num_vertices + num_split, Vec3<T>(0, 0, 0));
+  parallel_for(num_edges, [&](size_t i) {
+    if (marks[i].load(std::memory_order_relaxed)) {
+      edge_vertices[i] += uint32_t(num_vertices);
+      mesh.vertices[edge_vertices[i]] =
+          calc_edge_vertex(he, he.edges[i], scheme);
+    }
+  });
+
+  // Red triangles become four and green ones two. Each half of a red parent
+  // gives two of its four children, the child on the bisected edge is
+  // bisected again if that edge is split. Every triangle adds at most one
+  // green pair, the halves of a pair that is kept add it from side 0.
+  std::vector<uint32_t> tri_offsets(num_tris + 1);
+  std::vector<uint32_t> pair_offsets(num_tris + 1);
+  parallel_for(num_tris, [&](size_t i) {
+    if (sides[i] != no_side) {
+      bool is_red = is_red_parent(i);
+      tri_offsets[i] = is_red ? 2 + is_marked(i, 0) : 1;
+      pair_offsets[i] = is_red ? is_marked(i, 0) : sides[i] == 0;
+    } else {
+      int count = count_marks(i);
+      tri_offsets[i] = count == 3 ? 4 : count + 1;
+      pair_offsets[i] = count == 1;
+    }
+  });
+  tri_offsets[num_tris] =
+      parallel_exclusive_scan(tri_offsets.data(), num_tris);
+  pair_offsets[num_tris] =
+      parallel_exclusive_scan(pair_offsets.data(), num_tris);
+  std::vector<std::array<uint32_t, 3>> tris(tri_offsets[num_tris]);
+  std::vector<std::array<uint32_t, 2>> next_green_pairs(
+      pair_offsets[num_tris]);
+  parallel_for(num_tris, [&](size_t i) {
+    const auto &t = mesh.tris[i];
+    auto *out = tris.data() + tri_offsets[i];
+    auto add_green_pair = [&](uint32_t first) {
+      next_green_pairs[pair_offsets[i]] = {first, first + 1};
+    };
+    auto edge_vertex = [&](size_t ti, int k) {
+      return edge_vertices[get_edge(ti, k)];
+    };
+    if (sides[i] != no_side) {
+      if (!is_red_parent(i)) {
+        out[0] = t;
+        if (sides[i] == 0) {
+          next_green_pairs[pair_offsets[i]] = {tri_offsets[i],
+                                               tri_offsets[partners[i]]};
+        }
+        return;
+      }
+      // The parent {a, b, o} is split at m on a-b, q on b-o and p on o-a.
+      // Side 0 {a, m, o} gives {a, m, p} and {m, q, p}, side 1 {m, b, o}
+      // gives {m, b, q} and {o, p, q}.
+      uint32_t p, q;
+      std::array<uint32_t, 3> child;
+      if (sides[i] == 0) {
+        p = edge_vertex(i, 2);
+        q = edge_vertex(partners[i], 1);
+        child = {t[0], t[1], p};
+        out[0] = {t[1], q, p};
+      } else {
+        p = edge_vertex(partners[i], 2);
+        q = edge_vertex(i, 1);
+        child = {t[0], t[1], q};
+        out[0] = {t[2], p, q};
+      }
+      if (is_marked(i, 0)) {
+        bisect_triangle(child, 0, edge_vertex(i, 0), out + 1);
+        add_green_pair(tri_offsets[i] + 1);
+      } else {
+        out[1] = child;
+      }
+      return;
+    }
+    switch (count_marks(i)) {
+    case 0:
+      out[0] = t;
+      break;
+    case 3:
+      out[0] = {edge_vertex(i, 0), edge_vertex(i, 1), edge_vertex(i, 2)};
+      for (int c = 0; c < 3; c++) {
+        out[c + 1] = {t[c], edge_vertex(i, c), edge_vertex(i, (c + 2) % 3)};
+      }
+      break;
+    default:
+      for (int c = 0; c < 3; c++) {
+        if (is_marked(i, c)) {
+          bisect_triangle(t, c, edge_vertex(i, c), out);
+          add_green_pair(tri_offsets[i]);
+        }
+      }
+    }
+  });
+  mesh.tris = std::move(tris);
+  green_pairs = std::move(next_green_pairs);
+  return num_split;
+}
+
+// Splits every triangle into three around its centroid. Triangle t becomes
+// triangles 3t to 3t + 2 and its centroid is vertex num_vertices + t, so
+// every triangle is written in parallel at a fixed offset.
+template <typename T>
+Indexed_Tri_Mesh<T> poke_faces(const Indexed_Tri_Mesh<T> &mesh) {
+  const size_t num_vertices = mesh.vertices.size();
+  const size_t num_tris = mesh.tris.size();
+  Indexed_Tri_Mesh<T> out;
+  out.vertices.resize(num_vertices + num_tris, Vec3<T>(0, 0, 0));
+  out.tris.resize(num_tris * 3);
+  parallel_for(num_vertices,
+               [&](size_t i) { out.vertices[i] = mesh.vertices[i]; });
+  parallel_for(num_tris, [&](size_t i) {
+    const auto &t = mesh.tris[i];
+    const auto &p = mesh.vertices;
+    auto center = uint32_t(num_vertices + i);
+    out.vertices[center] = (p[t[0]] + p[t[1]] + p[t[2]]) / T(3);
+    for (int k = 0; k < 3; k++) {
+      out.tris[i * 3 + k] = {t[k], t[(k + 1) % 3], center};
+    }
+  });
+  return out;
+}
+
+// Same split for triangle soups, writes three triangles to out
+template <typename T>
+void poke_triangle(const Triangle<T> &t, Triangle<T> *out) {
+  auto center = (t.a + t.b + t.c) / T(3);
+  for (int k = 0; k < 3; k++) {
+    out[k] = {t[k], t[(k + 1) % 3], center};
+  }
+}
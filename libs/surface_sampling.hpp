@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "alias_table.hpp"
+#include "parallel.hpp"
+#include "point_cloud.hpp"
+#include "triangle.hpp"
+#include "vec3.hpp"
+
+// Sample the triangle uniformly:
+// https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations#SamplingaTriangle
+template <typename T>
+Vec3<T> uniform_sample_triangle(const Triangle<T> &t, T r1, T r2) {
+  T sqrt_r1 = std::sqrt(r1);
+  T u = 1 - sqrt_r1;
+  T v = r2 * sqrt_r1;
+
+  auto ab = t.b - t.a;
+  auto ac = t.c - t.a;
+
+  return u * ab + v * ac + t.a;
+}
+
+inline std::vector<double>
+calc_triangle_areas(const std::vector<Triangle<double>> &tris) {
+  std::vector<double> areas(tris.size());
+  parallel_for(tris.size(), [&](size_t i) { areas[i] = tris[i].calc_area(); });
+  return areas;
+}
+
+// Every block of samples draws from its own generator seeded with
+// (seed, block index), so output is identical for any number of threads.
+constexpr size_t samples_per_block = 1 << 16;
+
+inline std::mt19937_64 make_block_rng(uint64_t seed, uint64_t block) {
+  std::seed_seq seq{uint32_t(seed), uint32_t(seed >> 32), uint32_t(block),
+                    uint32_t(block >> 32)};
+  return std::mt19937_64(seq);
+}
+
+// With with_source set, the source triangle and barycentric coordinates of
+// every sample are recorded, see fill_point_attributes.
+inline Point_Cloud sample_surface_uniform(
+    const std::vector<Triangle<double>> &tris,
+    const Alias_Table &triangle_table, size_t num_samples, uint64_t seed,
+    bool with_source = false) {
+  Point_Cloud samples;
+  samples.points.resize(num_samples, Vec3<double>(0, 0, 0));
+  if (with_source) {
+    samples.tri_indices.resize(num_samples);
+    samples.barycentrics.resize(num_samples);
+  }
+  parallel_for_blocks(
+      num_samples, samples_per_block,
+      [&](size_t block, size_t begin, size_t end) {
+        auto rng = make_block_rng(seed, block);
+        std::uniform_real_distribution<double> real_dist(0.0, 1.0);
+        for (size_t i = begin; i < end; i++) {
+          auto tri_idx = triangle_table.sample(real_dist(rng));
+          const auto &t = tris[tri_idx];
+          double r1 = real_dist(rng);
+          double r2 = real_dist(rng);
+          samples.points[i] = uniform_sample_triangle(t, r1, r2);
+          if (with_source) {
+            double sqrt_r1 = std::sqrt(r1);
+            samples.tri_indices[i] = tri_idx;
+            samples.barycentrics[i] = {float(1 - sqrt_r1),
+                                       float(r2 * sqrt_r1)};
+          }
+        }
+      });
+  return samples;
+}
+
+// Derives normals and colours from the source triangles recorded by the
+// samplers and drops source data that is not part of attributes. Triangle
+// indices are offset by tri_index_offset afterwards.
+inline void
+fill_point_attributes(Point_Cloud &samples,
+                      const std::vector<Triangle<double>> &tris,
+                      uint32_t attributes,
+                      const std::vector<std::array<uint8_t, 3>> *tri_colors,
+                      uint32_t tri_index_offset = 0) {
+  const size_t n = samples.size();
+  if (attributes & Point_Normal) {
+    samples.normals.resize(n, Vec3<float>(0, 0, 0));
+    parallel_for(n, [&](size_t i) {
+      samples.normals[i] =
+          tris[samples.tri_indices[i]].calc_normal().as<float>();
+    });
+  }
+  if (attributes & Point_Color) {
+    samples.colors.resize(n);
+    parallel_for(n, [&](size_t i) {
+      samples.colors[i] = tri_colors
+                              ? (*tri_colors)[samples.tri_indices[i]]
+                              : std::array<uint8_t, 3>{255, 255, 255};
+    });
+  }
+  if (!(attributes & Point_Barycentric)) {
+    std::vector<std::array<float, 2>>().swap(samples.barycentrics);
+  }
+  if (!(attributes & Point_Tri_Index)) {
+    std::vector<uint32_t>().swap(samples.tri_indices);
+  } else if (tri_index_offset != 0) {
+    parallel_for(n,
+                 [&](size_t i) { samples.tri_indices[i] += tri_index_offset; });
+  }
+}
+
+// Poisson-disk sampling by dart throwing over an oversampled set of uniform
+// candidates. Candidates are binned into a spatial hash grid with cells as
+// wide as the disk radius, so a candidate is only tested against accepted
+// points in its 27 neighbouring cells. Cells are processed in 27 phases by
+// their coordinates mod 3, cells of the same phase are at least two cells
+// apart, so all cells of a phase are processed in parallel without locking.
+// The radius is chosen from the total area so that roughly num_samples points
+// are accepted, surfaces without area give no points.
+inline Point_Cloud
+sample_surface_poisson_disk(const std::vector<Triangle<double>> &tris,
+                            const Alias_Table &triangle_table,
+                            size_t num_samples, uint64_t seed,
+                            bool with_source = false) {
+  constexpr size_t candidates_per_sample = 8;
+  constexpr double radius_factor = 0.75;
+  constexpr size_t num_phases = 27;
+  if (num_samples == 0) {
+    return {};
+  }
+
+  const double radius =
+      radius_factor * std::sqrt(triangle_table.total_weight / num_samples);
+  if (!(radius > 0 && std::isfinite(radius))) {
+    return {};
+  }
+  const double radius_squared = radius * radius;
+  auto candidates =
+      sample_surface_uniform(tris, triangle_table,
+                             num_samples * candidates_per_sample, seed,
+                             with_source);
+  const size_t n = candidates.size();
+
+  Vec3<double> min = candidates.points[0];
+  for (const auto &p : candidates.points) {
+    min = min.min(p);
+  }
+
+  // Cell coordinates are packed into 21 bits each. Cells further out are
+  // clamped into the last one, which only makes it slower to search.
+  constexpr uint64_t max_cell = (1 << 21) - 1;
+  auto to_cell = [](double c) {
+    return c < double(max_cell) ? uint64_t(std::max(c, 0.0)) : max_cell;
+  };
+  auto pack_cell = [](uint64_t x, uint64_t y, uint64_t z) {
+    return x | (y << 21) | (z << 42);
+  };
+  auto cell_phase = [](uint64_t x, uint64_t y, uint64_t z) {
+    return size_t(x % 3 + 3 * (y % 3) + 9 * (z % 3));
+  };
+  size_t table_bits = 0;
+  while ((size_t(1) << table_bits) * num_phases * 4 < n) {
+    table_bits++;
+  }
+  const size_t table_size = size_t(1) << table_bits;
+  auto bucket_of = [&](uint64_t key, size_t phase) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    size_t slot = table_bits == 0 ? 0 : size_t(h >> (64 - table_bits));
+    return phase * table_size + slot;
+  };
+
+  std::vector<uint64_t> keys(n);
+  std::vector<uint32_t> buckets(n);
+  parallel_for(n, [&](size_t i) {
+    auto c = (candidates.points[i] - min) / radius;
+    uint64_t x = to_cell(c.x), y = to_cell(c.y), z = to_cell(c.z);
+    keys[i] = pack_cell(x, y, z);
+    buckets[i] = uint32_t(bucket_of(keys[i], cell_phase(x, y, z)));
+  });
+
+  // Stable counting sort of candidates by bucket
+  const size_t num_buckets = num_phases * table_size;
+  std::vector<uint32_t> bucket_offsets(num_buckets + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    bucket_offsets[buckets[i] + 1]++;
+  }
+  for (size_t b = 0; b < num_buckets; b++) {
+    bucket_offsets[b + 1] += bucket_offsets[b];
+  }
+  std::vector<uint64_t> sorted_keys(n);
+  std::vector<Vec3<double>> sorted_points(n, Vec3<double>(0, 0, 0));
+  std::vector<uint32_t> sorted_order(n);
+  {
+    std::vector<uint32_t> cursors(bucket_offsets.begin(),
+                                  bucket_offsets.end() - 1);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t j = cursors[buckets[i]]++;
+      sorted_keys[j] = keys[i];
+      sorted_points[j] = candidates.points[i];
+      sorted_order[j] = uint32_t(i);
+    }
+  }
+
+  std::vector<uint8_t> accepted(n, 0);
+  auto is_rejected = [&](size_t j) {
+    const uint64_t key = sorted_keys[j];
+    const int64_t x = key & 0x1FFFFF, y = (key >> 21) & 0x1FFFFF,
+                  z = key >> 42;
+    for (int64_t dz = -1; dz <= 1; dz++) {
+      for (int64_t dy = -1; dy <= 1; dy++) {
+        for (int64_t dx = -1; dx <= 1; dx++) {
+          uint64_t nx = x + dx, ny = y + dy, nz = z + dz;
+          // Also skips -1 wrapped to a huge value
+          if (nx > max_cell || ny > max_cell || nz > max_cell) {
+            continue;
+          }
+          uint64_t neighbour_key = pack_cell(nx, ny, nz);
+          size_t b = bucket_of(neighbour_key, cell_phase(nx, ny, nz));
+          // Only accepted flags of the neighbour cell itself may be read,
+          // other cells sharing the bucket can be written concurrently.
+          for (uint32_t m = bucket_offsets[b]; m < bucket_offsets[b + 1];
+               m++) {
+            if (sorted_keys[m] == neighbour_key && accepted[m] &&
+                (sorted_points[m] - sorted_points[j]).length_squared() <
+                    radius_squared) {
+              return true;
+            }
+          }
+        }
+      }
+    }
+    return false;
+  };
+  for (size_t phase = 0; phase < num_phases; phase++) {
+    parallel_for(
+        table_size,
+        [&](size_t slot) {
+          size_t b = phase * table_size + slot;
+          for (uint32_t j = bucket_offsets[b]; j < bucket_offsets[b + 1];
+               j++) {
+            accepted[j] = !is_rejected(j);
+          }
+        },
+        256);
+  }
+
+  Point_Cloud samples;
+  for (size_t j = 0; j < n; j++) {
+    if (!accepted[j]) {
+      continue;
+    }
+    samples.points.push_back(sorted_points[j]);
+    if (with_source) {
+      samples.tri_indices.push_back(candidates.tri_indices[sorted_order[j]]);
+      samples.barycentrics.push_back(
+          candidates.barycentrics[sorted_order[j]]);
+    }
+  }
+  return samples;
+}
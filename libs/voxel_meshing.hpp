@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "indexed_tri_mesh.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+
+// Exposed voxel faces point along one of six directions, 2 * axis for the
+// negative and 2 * axis + 1 for the positive side of the axis. Faces of one
+// direction are grouped in slices by the voxel coordinate along the axis,
+// and located within the slice by the coordinates along the two following
+// axes, u along (axis + 1) % 3 and v along (axis + 2) % 3.
+struct Voxel_Face {
+  uint8_t u, v;
+  uint8_t color_index;
+};
+
+using Voxel_Face_Slices = std::array<std::vector<std::vector<Voxel_Face>>, 6>;
+
+inline int count_trailing_zeros(uint64_t bits) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return int(index);
+#else
+  return __builtin_ctzll(bits);
+#endif
+}
+
+// Dense grid of voxels, stored as occupancy bits with 64 voxels along x per
+// word and as color indices that are 0 where the grid is empty
+struct Voxel_Grid {
+  std::array<int, 3> size = {0, 0, 0};
+  int row_words = 0;
+  // row_words words for every row along x, row y + size[1] * z
+  std::vector<uint64_t> occupancy;
+  std::vector<uint8_t> color_indices;
+
+  explicit Voxel_Grid(const std::array<int, 3> &size)
+      : size(size), row_words((size[0] + 63) / 64),
+        occupancy(size_t(row_words) * size[1] * size[2], 0),
+        color_indices(size_t(size[0]) * size[1] * size[2], 0) {}
+
+  size_t get_index(int x, int y, int z) const {
+    return (size_t(z) * size[1] + y) * size[0] + x;
+  }
+
+  // Returns false if the voxel was already set
+  bool set(int x, int y, int z, uint8_t color_index) {
+    uint64_t &word = occupancy[(size_t(z) * size[1] + y) * row_words + x / 64];
+    uint64_t bit = uint64_t(1) << (x % 64);
+    bool is_new = (word & bit) == 0;
+    word |= bit;
+    color_indices[get_index(x, y, z)] = color_index;
+    return is_new;
+  }
+
+  const uint64_t *get_row(int y, int z) const {
+    return &occupancy[(size_t(z) * size[1] + y) * row_words];
+  }
+};
+
+// Faces of the grid's voxels whose neighbour is empty. Each row is culled 64
+// voxels at a time, against itself shifted by one voxel along x and against
+// the neighbouring rows along y and z.
+inline Voxel_Face_Slices find_exposed_faces(const Voxel_Grid &grid) {
+  Voxel_Face_Slices slices;
+  for (int direction = 0; direction < 6; direction++) {
+    slices[direction].resize(grid.size[direction / 2]);
+  }
+  const int n = grid.row_words;
+  const std::vector<uint64_t> empty_row(n, 0);
+  std::array<uint64_t, 6> exposed;
+  for (int z = 0; z < grid.size[2]; z++) {
+    for (int y = 0; y < grid.size[1]; y++) {
+      const uint64_t *row = grid.get_row(y, z);
+      const uint64_t *neighbours[4] = {
+          y > 0 ? grid.get_row(y - 1, z) : empty_row.data(),
+          y + 1 < grid.size[1] ? grid.get_row(y + 1, z) : empty_row.data(),
+          z > 0 ? grid.get_row(y, z - 1) : empty_row.data(),
+          z + 1 < grid.size[2] ? grid.get_row(y, z + 1) : empty_row.data()};
+      for (int w = 0; w < n; w++) {
+        uint64_t occupied = row[w];
+        if (occupied == 0) {
+          continue;
+        }
+        uint64_t below = occupied << 1 | (w > 0 ? row[w - 1] >> 63 : 0);
+        uint64_t above = occupied >> 1 | (w + 1 < n ? row[w + 1] << 63 : 0);
+        exposed[0] = occupied & ~below;
+        exposed[1] = occupied & ~above;
+        for (int k = 0; k < 4; k++) {
+          exposed[2 + k] = occupied & ~neighbours[k][w];
+        }
+        for (int direction = 0; direction < 6; direction++) {
+          for (uint64_t bits = exposed[direction]; bits != 0;
+               bits &= bits - 1) {
+            int x = w * 64 + count_trailing_zeros(bits);
+            int p[3] = {x, y, z};
+            int axis = direction / 2;
+            slices[direction][p[axis]].push_back(
+                {uint8_t(p[(axis + 1) % 3]), uint8_t(p[(axis + 2) % 3]),
+                 grid.color_indices[grid.get_index(x, y, z)]});
+          }
+        }
+      }
+    }
+  }
+  return slices;
+}
+
+// Rectangle of width x height faces of one color whose first face is at
+// u, v of its slice
+struct Voxel_Rect {
+  int u, v, width, height;
+  uint8_t color_index;
+};
+
+// Indexed mesh of rectangles of voxel faces, with a color index per
+// triangle. Corners are lattice points and get their vertex through a dense
+// map from lattice point to vertex index, in order of first use, so faces
+// come out welded.
+template <typename T> struct Voxel_Mesh_Builder {
+  static constexpr uint32_t no_vertex = UINT32_MAX;
+
+  // Lattice points along each axis
+  std::array<int, 3> size;
+  std::vector<uint32_t> vertex_indices;
+  Indexed_Tri_Mesh<T> mesh;
+  std::vector<uint8_t> color_indices;
+
+  explicit Voxel_Mesh_Builder(const std::array<int, 3> &grid_size)
+      : size{grid_size[0] + 1, grid_size[1] + 1, grid_size[2] + 1},
+        vertex_indices(size_t(size[0]) * size[1] * size[2], no_vertex) {}
+
+  uint32_t get_vertex(const int *p) {
+    auto &index =
+        vertex_indices[(size_t(p[2]) * size[1] + p[1]) * size[0] + p[0]];
+    if (index == no_vertex) {
+      index = uint32_t(mesh.vertices.size());
+      mesh.vertices.push_back(Vec3<T>(T(p[0]), T(p[1]), T(p[2])));
+    }
+    return index;
+  }
+
+  // Appends the two outward facing triangles of the rectangle
+  void add_rect(int direction, int slice, const Voxel_Rect &rect) {
+    const int axis = direction / 2;
+    const bool is_positive = direction % 2 != 0;
+    auto get_corner = [&](int u, int v) {
+      int p[3];
+      p[axis] = slice + is_positive;
+      p[(axis + 1) % 3] = u;
+      p[(axis + 2) % 3] = v;
+      return get_vertex(p);
+    };
+    uint32_t i00 = get_corner(rect.u, rect.v);
+    uint32_t i10 = get_corner(rect.u + rect.width, rect.v);
+    uint32_t i01 = get_corner(rect.u, rect.v + rect.height);
+    uint32_t i11 = get_corner(rect.u + rect.width, rect.v + rect.height);
+    if (is_positive) {
+      mesh.tris.push_back({i00, i10, i01});
+      mesh.tris.push_back({i10, i11, i01});
+    } else {
+      mesh.tris.push_back({i00, i01, i10});
+      mesh.tris.push_back({i10, i01, i11});
+    }
+    color_indices.push_back(rect.color_index);
+    color_indices.push_back(rect.color_index);
+  }
+};
+
+// Bytes of the dense grids that Voxel_Grid and Voxel_Mesh_Builder allocate
+// for grid_size voxels, which dominate the memory used to mesh them
+inline size_t get_voxel_grid_bytes(const std::array<int, 3> &grid_size) {
+  size_t num_rows = size_t(grid_size[1]) * grid_size[2];
+  size_t num_voxels = size_t(grid_size[0]) * num_rows;
+  size_t num_lattice_points =
+      size_t(grid_size[0] + 1) * (grid_size[1] + 1) * (grid_size[2] + 1);
+  return num_rows * ((grid_size[0] + 63) / 64) * sizeof(uint64_t) +
+         num_voxels * sizeof(uint8_t) + num_lattice_points * sizeof(uint32_t);
+}
+
+// Two triangles for every face, in direction and slice order
+template <typename T>
+void mesh_voxel_faces(const Voxel_Face_Slices &slices,
+                      Voxel_Mesh_Builder<T> &builder) {
+  for (int direction = 0; direction < 6; direction++) {
+    for (size_t slice = 0; slice < slices[direction].size(); slice++) {
+      for (const auto &face : slices[direction][slice]) {
+        builder.add_rect(direction, int(slice),
+                         {face.u, face.v, 1, 1, face.color_index});
+      }
+    }
+  }
+}
+
+// Merges the faces of one slice into maximal rectangles of one color, each
+// grown along u first and then along v. mask holds width x height zeros and
+// is left that way.
+inline void greedy_mesh_slice(const std::vector<Voxel_Face> &faces, int width,
+                              int height, std::vector<uint8_t> &mask,
+                              std::vector<Voxel_Rect> &rects) {
+  for (const auto &face : faces) {
+    mask[face.v * width + face.u] = face.color_index;
+  }
+  for (int v = 0; v < height; v++) {
+    for (int u = 0; u < width;) {
+      uint8_t color_index = mask[v * width + u];
+      if (color_index == 0) {
+        u++;
+        continue;
+      }
+      int rect_width = 1;
+      while (u + rect_width < width &&
+             mask[v * width + u + rect_width] == color_index) {
+        rect_width++;
+      }
+      int rect_height = 1;
+      for (; v + rect_height < height; rect_height++) {
+        const uint8_t *row = &mask[(v + rect_height) * width + u];
+        int i = 0;
+        while (i < rect_width && row[i] == color_index) {
+          i++;
+        }
+        if (i < rect_width) {
+          break;
+        }
+      }
+      for (int j = 0; j < rect_height; j++) {
+        std::fill_n(&mask[(v + j) * width + u], rect_width, uint8_t(0));
+      }
+      rects.push_back({u, v, rect_width, rect_height, color_index});
+      u += rect_width;
+    }
+  }
+}
+
+// Greedy meshing of exposed faces in a grid of grid_size voxels. Slices are
+// merged in parallel and their rectangles added in direction and slice
+// order. Rectangles of neighbouring slices do not share their corners, so
+// the surface has T-junctions where they meet.
+template <typename T>
+void greedy_mesh_voxel_faces(const Voxel_Face_Slices &slices,
+                             const std::array<int, 3> &grid_size,
+                             Voxel_Mesh_Builder<T> &builder) {
+  std::vector<std::array<int, 2>> tasks;
+  for (int direction = 0; direction < 6; direction++) {
+    for (size_t slice = 0; slice < slices[direction].size(); slice++) {
+      if (!slices[direction][slice].empty()) {
+        tasks.push_back({direction, int(slice)});
+      }
+    }
+  }
+  std::vector<std::vector<Voxel_Rect>> task_rects(tasks.size());
+  parallel_for(
+      tasks.size(),
+      [&](size_t i) {
+        auto [direction, slice] = tasks[i];
+        int axis = direction / 2;
+        int width = grid_size[(axis + 1) % 3];
+        int height = grid_size[(axis + 2) % 3];
+        std::vector<uint8_t> mask(size_t(width) * height, 0);
+        greedy_mesh_slice(slices[direction][slice], width, height, mask,
+                          task_rects[i]);
+      },
+      1);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    for (const auto &rect : task_rects[i]) {
+      builder.add_rect(tasks[i][0], tasks[i][1], rect);
+    }
+  }
+}